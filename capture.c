@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "helpers.h"
+
+/* how often the writer thread flushes, in ms */
+#define CAPTURE_FLUSH_INTERVAL 10
+
+static void writeN(FILE *to, uint32_t n)
+{
+    unsigned char buf[4];
+    buf[0] = n >> 24;
+    buf[1] = n >> 16;
+    buf[2] = n >> 8;
+    buf[3] = n;
+    fwrite(buf, 1, 4, to);
+}
+
+static int readN(FILE *from, uint32_t *into)
+{
+    unsigned char buf[4];
+    if (fread(buf, 1, 4, from) != 4) return 0;
+    *into = ((uint32_t) buf[0] << 24) |
+            ((uint32_t) buf[1] << 16) |
+            ((uint32_t) buf[2] << 8) |
+             (uint32_t) buf[3];
+    return 1;
+}
+
+static void *captureWriterThread(void *vpwriter)
+{
+    struct CaptureWriter *writer = (struct CaptureWriter *) vpwriter;
+    struct CaptureEvent cev;
+    int closing;
+
+    do {
+        closing = writer->closing;
+        while (ringBufferPop(writer->ring, &cev)) {
+            writeN(writer->to, (uint32_t) cev.ev.timestamp);
+            writeN(writer->to, (uint32_t) cev.ev.message);
+            writeN(writer->to, (uint32_t) cev.source);
+        }
+        fflush(writer->to);
+        if (!closing) Pt_Sleep(CAPTURE_FLUSH_INTERVAL);
+    } while (!closing);
+
+    return NULL;
+}
+
+struct CaptureWriter *captureWriterOpen(FILE *to, PtTimestamp start, int32_t size)
+{
+    struct CaptureWriter *writer;
+    int tmpi;
+
+    SF(writer, calloc, NULL, (1, sizeof(struct CaptureWriter)));
+    writer->to = to;
+    writer->ring = ringBufferNew(sizeof(struct CaptureEvent), size);
+
+    /* write the header now, we have plenty of time */
+    fwrite(CAPTURE_MAGIC, 1, 4, to);
+    writeN(to, CAPTURE_VERSION);
+    writeN(to, (uint32_t) start);
+
+    tmpi = pthread_create(&writer->thread, NULL, captureWriterThread, writer);
+    if (tmpi != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(tmpi));
+        exit(1);
+    }
+
+    return writer;
+}
+
+void captureWriterAdd(struct CaptureWriter *writer, PmEvent *events, int *sources, int32_t ct)
+{
+    struct CaptureEvent cev;
+    int32_t i;
+    for (i = 0; i < ct; i++) {
+        cev.ev = events[i];
+        cev.source = sources ? sources[i] : 0;
+        if (!ringBufferPush(writer->ring, &cev))
+            writer->dropped++;
+    }
+}
+
+void captureWriterClose(struct CaptureWriter *writer)
+{
+    writer->closing = 1;
+    pthread_join(writer->thread, NULL);
+    fclose(writer->to);
+
+    if (writer->dropped)
+        fprintf(stderr, "Warning: %u events were dropped from the capture.\n", (unsigned) writer->dropped);
+
+    ringBufferFree(writer->ring);
+    free(writer);
+}
+
+void captureWrite(FILE *to, PtTimestamp start, PmEvent *events, int *sources, int32_t ct)
+{
+    int32_t i;
+    fwrite(CAPTURE_MAGIC, 1, 4, to);
+    writeN(to, CAPTURE_VERSION);
+    writeN(to, (uint32_t) start);
+    for (i = 0; i < ct; i++) {
+        writeN(to, (uint32_t) events[i].timestamp);
+        writeN(to, (uint32_t) events[i].message);
+        writeN(to, (uint32_t) (sources ? sources[i] : 0));
+    }
+}
+
+int32_t captureRead(FILE *from, PtTimestamp *start, PmEvent **events, int **sources)
+{
+    char magic[4];
+    uint32_t version, n, timestamp, message, source = 0;
+    int32_t ct = 0, bufsz = 1024;
+    PmEvent *buf;
+    int *sbuf;
+
+    /* check the header */
+    if (fread(magic, 1, 4, from) != 4 || memcmp(magic, CAPTURE_MAGIC, 4))
+        return -1;
+    if (!readN(from, &version) || version < 1 || version > CAPTURE_VERSION)
+        return -1;
+    if (!readN(from, &n))
+        return -1;
+    *start = (PtTimestamp) n;
+
+    /* then read in all the events */
+    SF(buf, malloc, NULL, (bufsz * sizeof(PmEvent)));
+    SF(sbuf, malloc, NULL, (bufsz * sizeof(int)));
+    while (readN(from, &timestamp)) {
+        if (!readN(from, &message) ||
+            (version >= 2 && !readN(from, &source))) {
+            free(buf);
+            free(sbuf);
+            return -1;
+        }
+        if (ct >= bufsz) {
+            bufsz *= 2;
+            SF(buf, realloc, NULL, (buf, bufsz * sizeof(PmEvent)));
+            SF(sbuf, realloc, NULL, (sbuf, bufsz * sizeof(int)));
+        }
+        buf[ct].timestamp = (PmTimestamp) timestamp;
+        buf[ct].message = (PmMessage) message;
+        sbuf[ct] = (int) source;
+        ct++;
+    }
+
+    *events = buf;
+    *sources = sbuf;
+    return ct;
+}
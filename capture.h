@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "portmidi.h"
+#include "porttime.h"
+#include "ringbuffer.h"
+
+/* Captures are raw recordings of the input events of a humidity session, for
+ * replaying. All numbers are 32-bit big-endian. The format is:
+ *
+ * "HCAP" version start
+ * then, for each event: timestamp message source
+ *
+ * start is the timestamp at which the input file started streaming, and
+ * source is which of the input devices the event came from. Version 1
+ * captures have no source (it's always 0), and are still read. */
+#define CAPTURE_MAGIC "HCAP"
+#define CAPTURE_VERSION 2
+
+/* an event in a capture */
+struct CaptureEvent {
+    PmEvent ev;
+    int32_t source;
+};
+
+/* a capture being written. Events are added from the timer thread into a
+ * preallocated ring, and written to the file by a thread of its own */
+struct CaptureWriter {
+    FILE *to;
+    struct RingBuffer *ring;
+    pthread_t thread;
+    volatile int closing;
+
+    /* events lost because the ring was full */
+    volatile uint32_t dropped;
+};
+
+/* start writing a capture to the given (already open) file, buffering up to
+ * size events */
+struct CaptureWriter *captureWriterOpen(FILE *to, PtTimestamp start, int32_t size);
+
+/* add events from the given sources (NULL for all from 0) to a capture. Safe
+ * to call from the timer thread, never blocks */
+void captureWriterAdd(struct CaptureWriter *writer, PmEvent *events, int *sources, int32_t ct);
+
+/* finish writing a capture, flushing anything left and closing the file */
+void captureWriterClose(struct CaptureWriter *writer);
+
+/* write an entire capture at once. sources may be NULL */
+void captureWrite(FILE *to, PtTimestamp start, PmEvent *events, int *sources, int32_t ct);
+
+/* read an entire capture from a file. Returns the number of events read (and
+ * allocated into *events and *sources), or -1 if it's not a valid capture */
+int32_t captureRead(FILE *from, PtTimestamp *start, PmEvent **events, int **sources);
+
+#endif
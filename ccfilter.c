@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccfilter.h"
+#include "helpers.h"
+#include "midifile/midi.h"
+
+struct CCFilter *ccFilterNew(int lanes, uint32_t interval)
+{
+    struct CCFilter *filter;
+    size_t slots = (size_t) lanes * CCFILTER_SLOTS;
+
+    SF(filter, calloc, NULL, (1, sizeof(struct CCFilter)));
+    filter->lanes = lanes;
+    filter->interval = interval;
+    SF(filter->last, malloc, NULL, (slots * sizeof(int16_t)));
+    SF(filter->pending, malloc, NULL, (slots * sizeof(int16_t)));
+    SF(filter->lastTm, calloc, NULL, (slots, sizeof(uint32_t)));
+    SF(filter->pendingList, malloc, NULL, (slots * sizeof(uint32_t)));
+    SF(filter->listed, calloc, NULL, (slots, sizeof(uint8_t)));
+    memset(filter->last, 0xFF, slots * sizeof(int16_t));
+    memset(filter->pending, 0xFF, slots * sizeof(int16_t));
+
+    return filter;
+}
+
+void ccFilterFree(struct CCFilter *filter)
+{
+    free(filter->last);
+    free(filter->pending);
+    free(filter->lastTm);
+    free(filter->pendingList);
+    free(filter->listed);
+    free(filter);
+}
+
+int ccFilterPass(struct CCFilter *filter, int lane, PmMessage message, uint32_t tm)
+{
+    uint8_t status = Pm_MessageStatus(message);
+    uint8_t controller = Pm_MessageData1(message);
+    int16_t value = Pm_MessageData2(message);
+    uint32_t slot;
+
+    if ((status >> 4) != MIDI_CONTROLLER || lane < 0 || lane >= filter->lanes)
+        return 1;
+    slot = lane * CCFILTER_SLOTS + (status & 0xF) * 128;
+
+    /* channel mode messages (120 and up) do things beyond setting a value.
+     * Of them, only reset all controllers changes any controllers, so after
+     * it we can't know what the receiver has, and anything held back is moot
+     * (the others leave controllers alone) */
+    if (controller >= 120) {
+        if (controller == 121) {
+            memset(filter->last + slot, 0xFF, 128 * sizeof(int16_t));
+            memset(filter->pending + slot, 0xFF, 128 * sizeof(int16_t));
+        }
+        return 1;
+    }
+    slot += controller;
+
+    /* already there (or on its way)? */
+    if (value == filter->last[slot]) {
+        if (filter->pending[slot] >= 0) {
+            /* it's come back, so the held back value is moot */
+            filter->pending[slot] = -1;
+        }
+        filter->dropped++;
+        return 0;
+    }
+    if (value == filter->pending[slot]) {
+        filter->dropped++;
+        return 0;
+    }
+
+    /* too soon? */
+    if (filter->interval && filter->last[slot] >= 0 &&
+        tm - filter->lastTm[slot] < filter->interval) {
+        if (filter->pending[slot] >= 0)
+            filter->dropped++;
+        if (!filter->listed[slot]) {
+            filter->pendingList[filter->pendingCt++] = slot;
+            filter->listed[slot] = 1;
+        }
+        filter->pending[slot] = value;
+        return 0;
+    }
+
+    filter->last[slot] = value;
+    filter->lastTm[slot] = tm;
+    filter->pending[slot] = -1;
+    return 1;
+}
+
+int ccFilterDue(struct CCFilter *filter, uint32_t tm, int all, int *lane,
+    PmMessage *message, uint32_t *due)
+{
+    int32_t i;
+    uint32_t slot;
+
+    for (i = 0; i < filter->pendingCt; i++) {
+        slot = filter->pendingList[i];
+
+        if (filter->pending[slot] < 0) {
+            /* no longer pending */
+            filter->listed[slot] = 0;
+            filter->pendingList[i--] = filter->pendingList[--filter->pendingCt];
+            continue;
+        }
+
+        if (all || tm - filter->lastTm[slot] >= filter->interval) {
+            *lane = slot / CCFILTER_SLOTS;
+            *message = Pm_Message(
+                Pm_MessageStatusGen(MIDI_CONTROLLER, (slot / 128) % 16),
+                slot % 128, filter->pending[slot]);
+            *due = filter->lastTm[slot] + filter->interval;
+
+            filter->last[slot] = filter->pending[slot];
+            filter->lastTm[slot] = *due;
+            filter->pending[slot] = -1;
+            filter->listed[slot] = 0;
+            filter->pendingList[i] = filter->pendingList[--filter->pendingCt];
+            return 1;
+        }
+    }
+
+    return 0;
+}
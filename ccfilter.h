@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CCFILTER_H
+#define CCFILTER_H
+
+#include <stdint.h>
+
+#include "portmidi.h"
+
+/* controller slots per lane: 16 channels of 128 controllers */
+#define CCFILTER_SLOTS 2048
+
+/* a filter for controller messages, which drops messages which wouldn't
+ * change a controller's value, and holds back changes which come too quickly
+ * after the last, sending only the latest once the interval has passed. Each
+ * lane (e.g. an output device or track) is filtered separately. Times are in
+ * whatever units the user likes, so long as they're consistent */
+struct CCFilter {
+    int lanes;
+    uint32_t interval; /* 0 to only drop redundant messages */
+
+    /* per slot: the last value passed and when (-1 for none), and any value
+     * being held back (-1 for none) */
+    int16_t *last, *pending;
+    uint32_t *lastTm;
+
+    /* slots with pending values, each at most once (listed is set while a
+     * slot is in the list, which may be after its value stops pending) */
+    uint32_t *pendingList;
+    int32_t pendingCt;
+    uint8_t *listed;
+
+    /* messages dropped as redundant or superseded */
+    uint32_t dropped;
+};
+
+/* allocate a filter */
+struct CCFilter *ccFilterNew(int lanes, uint32_t interval);
+
+void ccFilterFree(struct CCFilter *filter);
+
+/* filter a message. Returns 1 if it should be sent now, or 0 if it's been
+ * dropped or held back. Messages other than controllers always pass, as do
+ * channel mode messages (a reset all controllers also makes the filter forget
+ * that channel's values) and messages for lanes out of range */
+int ccFilterPass(struct CCFilter *filter, int lane, PmMessage message, uint32_t tm);
+
+/* get a held back message which is due by tm (or any, if all is set).
+ * Returns 0 if there are none, or 1 with its lane, message and the time it
+ * became due */
+int ccFilterDue(struct CCFilter *filter, uint32_t tm, int all, int *lane,
+    PmMessage *message, uint32_t *due);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "colfile.h"
+#include "helpers.h"
+#include "midifile/midi.h"
+#include "smf.h"
+
+/* add an event to a track, returning its index */
+static uint32_t addEvent(struct ColTrack *track, uint32_t tick, PmMessage message, int32_t meta)
+{
+    if (track->count >= track->size) {
+        track->size = track->size ? track->size * 2 : 256;
+        SF(track->ticks, realloc, NULL, (track->ticks, track->size * sizeof(uint32_t)));
+        SF(track->messages, realloc, NULL, (track->messages, track->size * sizeof(PmMessage)));
+        SF(track->metas, realloc, NULL, (track->metas, track->size * sizeof(int32_t)));
+    }
+    track->ticks[track->count] = tick;
+    track->messages[track->count] = message;
+    track->metas[track->count] = meta;
+    return track->count++;
+}
+
+/* add a meta to the blob, returning its offset */
+static int32_t addMeta(struct ColFile *file, uint8_t type, uint32_t length,
+    const unsigned char *data)
+{
+    size_t offset = file->metaLength, entry;
+    struct ColMeta *meta;
+
+    entry = offsetof(struct ColMeta, data) + length + 1;
+    entry = (entry + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    if (offset + entry > file->metaSize) {
+        if (!file->metaSize) file->metaSize = 1024;
+        while (offset + entry > file->metaSize) file->metaSize *= 2;
+        SF(file->metaBlob, realloc, NULL, (file->metaBlob, file->metaSize));
+    }
+    file->metaLength += entry;
+
+    meta = COL_META(file, offset);
+    meta->length = length;
+    meta->type = type;
+    if (length) memcpy(meta->data, data, length);
+    meta->data[length] = 0;
+
+    return (int32_t) offset;
+}
+
+static struct ColFile *newFile(uint16_t format, uint16_t timeDivision, int trackCt)
+{
+    struct ColFile *file;
+    SF(file, calloc, NULL, (1, sizeof(struct ColFile)));
+    file->format = format;
+    file->timeDivision = timeDivision;
+    file->trackCt = trackCt;
+    SF(file->tracks, calloc, NULL, (trackCt ? trackCt : 1, sizeof(struct ColTrack)));
+    return file;
+}
+
+struct ColFile *colFileLoad(const char *filename)
+{
+    struct SmfFile *smf;
+    struct SmfTrackReader *reader;
+    struct SmfEvent event;
+    struct ColFile *file;
+    int ti, rd;
+
+    if (!(smf = smfOpen(filename))) return NULL;
+    file = newFile(smf->format, smf->timeDivision, smf->trackCt);
+
+    for (ti = 0; ti < smf->trackCt; ti++) {
+        struct ColTrack *track = file->tracks + ti;
+
+        reader = smfTrackOpen(smf, ti);
+        while ((rd = smfTrackRead(reader, &event)) > 0) {
+            if (event.status == SMF_STATUS_META ||
+                event.status == SMF_STATUS_SYSEX ||
+                event.status == SMF_STATUS_SYSEX_ESCAPE) {
+                addEvent(track, event.tick, Pm_Message(event.status, 0, 0),
+                    addMeta(file, (event.status == SMF_STATUS_META) ? event.metaType : 0,
+                        event.length, event.bytes));
+            } else {
+                addEvent(track, event.tick,
+                    Pm_Message(event.status, event.data[0], event.data[1]), -1);
+            }
+        }
+
+        /* keep the end of the track where it was */
+        if (rd == 0 && reader->endOfTrack)
+            addEvent(track, reader->tick, Pm_Message(MIDI_STATUS_META, 0, 0),
+                addMeta(file, SMF_META_END_OF_TRACK, 0, NULL));
+        smfTrackClose(reader);
+
+        if (rd < 0) {
+            fprintf(stderr, "%s is corrupt.\n", filename);
+            smfClose(smf);
+            colFileFree(file);
+            return NULL;
+        }
+    }
+
+    smfClose(smf);
+    return file;
+}
+
+int colFileWrite(struct ColFile *file, const char *filename)
+{
+    struct SmfWriter *writer;
+    struct SmfEvent event;
+    int ti;
+    uint32_t ei, endTick;
+
+    writer = smfWriterOpen(filename, file->format, file->trackCt, file->timeDivision);
+
+    for (ti = 0; ti < file->trackCt; ti++) {
+        struct ColTrack *track = file->tracks + ti;
+
+        smfWriterBeginTrack(writer);
+        endTick = 0;
+        for (ei = 0; ei < track->count; ei++) {
+            PmMessage message = track->messages[ei];
+
+            event.tick = track->ticks[ei];
+            event.status = Pm_MessageStatus(message);
+            if (track->metas[ei] >= 0) {
+                struct ColMeta *meta = COL_META(file, track->metas[ei]);
+
+                /* the writer ends the track itself */
+                if (event.status == SMF_STATUS_META && meta->type == SMF_META_END_OF_TRACK) {
+                    endTick = event.tick;
+                    continue;
+                }
+
+                event.metaType = meta->type;
+                event.length = meta->length;
+                event.bytes = meta->data;
+            } else {
+                event.data[0] = Pm_MessageData1(message);
+                event.data[1] = Pm_MessageData2(message);
+            }
+            smfWriterEvent(writer, &event);
+        }
+        smfWriterEndTrackAt(writer, endTick);
+    }
+
+    return smfWriterClose(writer);
+}
+
+struct ColFile *colFileFromMf(MfFile *mf)
+{
+    struct ColFile *file;
+    MfEvent *cur;
+    int ti;
+
+    file = newFile(mf->format, mf->timeDivision, mf->trackCt);
+
+    for (ti = 0; ti < mf->trackCt; ti++) {
+        struct ColTrack *track = file->tracks + ti;
+        for (cur = mf->tracks[ti]->head; cur; cur = cur->next) {
+            addEvent(track, cur->absoluteTm, cur->e.message,
+                cur->meta ? addMeta(file, cur->meta->type, cur->meta->length, cur->meta->data) : -1);
+        }
+    }
+
+    return file;
+}
+
+MfFile *colFileToMf(struct ColFile *file)
+{
+    MfFile *mf;
+    MfTrack *mtrack;
+    MfEvent *event;
+    int ti;
+    uint32_t ei, lastTick;
+
+    mf = Mf_NewFile(file->timeDivision);
+    mf->format = file->format;
+
+    for (ti = 0; ti < file->trackCt; ti++) {
+        struct ColTrack *track = file->tracks + ti;
+
+        mtrack = Mf_NewTrack(mf);
+        lastTick = 0;
+        for (ei = 0; ei < track->count; ei++) {
+            event = Mf_NewEvent();
+            event->absoluteTm = track->ticks[ei];
+            event->deltaTm = track->ticks[ei] - lastTick;
+            lastTick = track->ticks[ei];
+            event->e.message = track->messages[ei];
+
+            if (track->metas[ei] >= 0) {
+                struct ColMeta *meta = COL_META(file, track->metas[ei]);
+                event->meta = Mf_NewMeta(meta->length);
+                event->meta->type = meta->type;
+                memcpy(event->meta->data, meta->data, meta->length);
+            }
+
+            if (mtrack->tail) mtrack->tail->next = event;
+            else mtrack->head = event;
+            mtrack->tail = event;
+        }
+    }
+
+    return mf;
+}
+
+void colFileFree(struct ColFile *file)
+{
+    int ti;
+    for (ti = 0; ti < file->trackCt; ti++) {
+        free(file->tracks[ti].ticks);
+        free(file->tracks[ti].messages);
+        free(file->tracks[ti].metas);
+    }
+    free(file->tracks);
+    free(file->metaBlob);
+    free(file);
+}
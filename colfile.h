@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef COLFILE_H
+#define COLFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "midifile/midifile.h"
+
+/* A MIDI file stored by column rather than as lists of events: each track is
+ * an array of ticks and an array of messages, with metas (and sysex) kept
+ * together in one blob for the whole file. Transforms over every event are
+ * then just loops over arrays. */
+
+/* a meta (or sysex) in the blob. Always aligned, and followed by a NUL so
+ * text can be used directly */
+struct ColMeta {
+    uint32_t length;
+    uint8_t type; /* the meta type, or 0 for sysex */
+    unsigned char data[1];
+};
+
+struct ColTrack {
+    uint32_t count, size;
+
+    /* the absolute tick of each event */
+    uint32_t *ticks;
+
+    /* each event's message. Metas are MIDI_STATUS_META (and sysex has its
+     * own status) */
+    PmMessage *messages;
+
+    /* for metas and sysex, the offset of its ColMeta in the blob, else -1 */
+    int32_t *metas;
+};
+
+struct ColFile {
+    uint16_t format, timeDivision;
+    int trackCt;
+    struct ColTrack *tracks;
+
+    unsigned char *metaBlob;
+    size_t metaLength, metaSize;
+};
+
+/* get a meta by its offset */
+#define COL_META(file, offset) ((struct ColMeta *) ((file)->metaBlob + (offset)))
+
+/* load a MIDI file straight into columns. Returns NULL (with a message) if
+ * it's not valid */
+struct ColFile *colFileLoad(const char *filename);
+
+/* write a file out. Returns 0 if it couldn't be written */
+int colFileWrite(struct ColFile *file, const char *filename);
+
+/* convert to and from MfFiles. Neither frees its argument */
+struct ColFile *colFileFromMf(MfFile *mf);
+MfFile *colFileToMf(struct ColFile *file);
+
+void colFileFree(struct ColFile *file);
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "eventpool.h"
+#include "helpers.h"
+
+struct EventPool *eventPoolNew(size_t eventCt, size_t metaCt, size_t metaLength)
+{
+    struct EventPool *pool;
+
+    SF(pool, calloc, NULL, (1, sizeof(struct EventPool)));
+    if (eventCt == 0) eventCt = 1;
+    if (metaCt == 0) metaCt = 1;
+
+    /* allocate it all zeroed now, so that taking from it is just a bump */
+    SF(pool->events, calloc, NULL, (eventCt, sizeof(MfEvent)));
+    pool->eventCt = eventCt;
+
+    pool->metaSize = sizeof(MfMeta) + metaLength;
+    pool->metaSize = (pool->metaSize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    SF(pool->metas, calloc, NULL, (metaCt, pool->metaSize));
+    pool->metaLength = metaLength;
+    pool->metaCt = metaCt;
+
+    return pool;
+}
+
+void eventPoolFree(struct EventPool *pool)
+{
+    free(pool->events);
+    free(pool->metas);
+    free(pool);
+}
+
+MfEvent *eventPoolNewEvent(struct EventPool *pool)
+{
+    if (pool->eventsUsed >= pool->eventCt) {
+        pool->eventMisses++;
+        return Mf_NewEvent();
+    }
+    return pool->events + pool->eventsUsed++;
+}
+
+MfEvent *eventPoolNewMetaEvent(struct EventPool *pool, uint32_t length)
+{
+    MfEvent *event;
+
+    /* pool events only ever have pool metas, so we can free them easily */
+    if (pool->eventsUsed >= pool->eventCt ||
+        pool->metasUsed >= pool->metaCt ||
+        length > pool->metaLength) {
+        pool->metaMisses++;
+        event = Mf_NewEvent();
+        event->meta = Mf_NewMeta(length);
+        return event;
+    }
+
+    event = pool->events + pool->eventsUsed++;
+    event->meta = (MfMeta *) (pool->metas + pool->metaSize * pool->metasUsed++);
+    event->meta->length = length;
+    return event;
+}
+
+int eventPoolOwns(struct EventPool *pool, MfEvent *event)
+{
+    return (event >= pool->events && event < pool->events + pool->eventCt);
+}
+
+void eventPoolFreeFile(struct EventPool *pool, MfFile *file)
+{
+    int ti;
+
+    /* take all the pool events out of the tracks, then the rest is normal */
+    for (ti = 0; ti < file->trackCt; ti++) {
+        MfEvent **cur = &file->tracks[ti]->head;
+        while (*cur) {
+            if (eventPoolOwns(pool, *cur)) {
+                *cur = (*cur)->next;
+            } else {
+                cur = &(*cur)->next;
+            }
+        }
+    }
+
+    Mf_FreeFile(file);
+}
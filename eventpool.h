@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef EVENTPOOL_H
+#define EVENTPOOL_H
+
+#include <stddef.h>
+
+#include "midifile/midifile.h"
+
+/* a preallocated arena of events and small metas. Events are never freed
+ * individually; when a file built from pool events is done with, free it with
+ * eventPoolFreeFile, then free the pool. When the pool runs dry, events come
+ * from the heap instead, and are counted as misses */
+struct EventPool {
+    MfEvent *events;
+    size_t eventCt, eventsUsed;
+
+    unsigned char *metas;
+    size_t metaSize, metaLength, metaCt, metasUsed;
+
+    /* events which had to come from the heap */
+    size_t eventMisses, metaMisses;
+};
+
+/* allocate a pool of eventCt events, metaCt of which may have metas of up to
+ * metaLength bytes */
+struct EventPool *eventPoolNew(size_t eventCt, size_t metaCt, size_t metaLength);
+
+/* free a pool. Any files with pool events must have been freed already */
+void eventPoolFree(struct EventPool *pool);
+
+/* get a new event */
+MfEvent *eventPoolNewEvent(struct EventPool *pool);
+
+/* get a new event with a meta of the given length */
+MfEvent *eventPoolNewMetaEvent(struct EventPool *pool, uint32_t length);
+
+/* is this event from the pool? */
+int eventPoolOwns(struct EventPool *pool, MfEvent *event);
+
+/* free a file which may contain pool events */
+void eventPoolFreeFile(struct EventPool *pool, MfFile *file);
+
+#endif
@@ -24,66 +24,57 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "colfile.h"
 #include "helpers.h"
 #include "midifile/midi.h"
-#include "midifile/midifile.h"
-#include "pmhelpers.h"
 
-PortMidiStream *stream;
-
-void dump(MfEvent *ev);
+void dump(struct ColFile *file, struct ColTrack *track, uint32_t ei, uint32_t lastTick);
 
 int main(int argc, char **argv)
 {
-    FILE *f;
-    PmError perr;
-    MfFile *pf;
+    struct ColFile *cf;
     int ti;
-    MfTrack *track;
-    MfEvent *cur;
+    struct ColTrack *track;
+    uint32_t ei, lastTick;
 
     if (argc < 2) {
         fprintf(stderr, "Use: hdumpfile <file> [output file]\n");
         return 1;
     }
 
-    PSF(perr, Mf_Initialize, ());
-
-    /* open it for input */
-    SF(f, fopen, NULL, (argv[1], "rb"));
-
-    /* and read it */
-    PSF(perr, Mf_ReadMidiFile, (&pf, f));
-    fclose(f);
+    /* read it */
+    if (!(cf = colFileLoad(argv[1]))) return 1;
 
     /* maybe write it out */
-    if (argc > 2) {
-        SF(f, fopen, NULL, (argv[2], "wb"));
-        PSF(perr, Mf_WriteMidiFile, (f, pf));
-        fclose(f);
+    if (argc > 2 && !colFileWrite(cf, argv[2])) {
+        fprintf(stderr, "Failed to write %s.\n", argv[2]);
+        return 1;
     }
 
-    for (ti = 0; ti < pf->trackCt; ti++) {
-        printf("Track %d/%d\n", ti, pf->trackCt);
-        track = pf->tracks[ti];
-        cur = track->head;
-        while (cur) {
-            dump(cur);
-            cur = cur->next;
+    for (ti = 0; ti < cf->trackCt; ti++) {
+        printf("Track %d/%d\n", ti, cf->trackCt);
+        track = cf->tracks + ti;
+        lastTick = 0;
+        for (ei = 0; ei < track->count; ei++) {
+            dump(cf, track, ei, lastTick);
+            lastTick = track->ticks[ei];
         }
     }
 
+    colFileFree(cf);
+
     return 0;
 }
 
-void dump(MfEvent *event)
+void dump(struct ColFile *file, struct ColTrack *track, uint32_t ei, uint32_t lastTick)
 {
-    PmEvent ev = event->e;
+    PmMessage message = track->messages[ei];
+    struct ColMeta *meta = (track->metas[ei] >= 0) ? COL_META(file, track->metas[ei]) : NULL;
     uint8_t type;
 
-    printf("+%d (%d) ", event->deltaTm, event->absoluteTm);
+    printf("+%d (%d) ", track->ticks[ei] - lastTick, track->ticks[ei]);
 
-    type = Pm_MessageType(ev.message);
+    type = Pm_MessageType(message);
     switch (type) {
         case MIDI_NOTE_ON:              printf("On: "); break;
         case MIDI_NOTE_OFF:             printf("Off: "); break;
@@ -94,21 +85,21 @@ void dump(MfEvent *event)
         case MIDI_PITCH_BEND:           printf("Pitch bend: "); break;
         case MIDI_META:                 printf("Meta/sysex: "); break;
 
-        default:                        printf("??" "(%X): ", Pm_MessageType(ev.message));
+        default:                        printf("??" "(%X): ", Pm_MessageType(message));
     }
     if (type < 0xF) {
-        printf("ch%d %d %d\n", (int) Pm_MessageChannel(ev.message),
-            (int) Pm_MessageData1(ev.message),
-            (int) Pm_MessageData2(ev.message));
-    } else if (event->meta) {
-        if (event->meta->type >= MIDI_M_TEXT && event->meta->type <= MIDI_M_CUE) {
+        printf("ch%d %d %d\n", (int) Pm_MessageChannel(message),
+            (int) Pm_MessageData1(message),
+            (int) Pm_MessageData2(message));
+    } else if (meta) {
+        if (meta->type >= MIDI_M_TEXT && meta->type <= MIDI_M_CUE) {
             /* it's text data */
-            printf("%02X text=%s\n", (int) event->meta->type, (char *) event->meta->data);
+            printf("%02X text=%s\n", (int) meta->type, (char *) meta->data);
         } else {
-            int i;
-            printf("%02X len=%d data=", (int) event->meta->type, (int) event->meta->length);
-            for (i = 0; i < event->meta->length; i++)
-                printf("%02X", (int) event->meta->data[i]);
+            uint32_t i;
+            printf("%02X len=%d data=", (int) meta->type, (int) meta->length);
+            for (i = 0; i < meta->length; i++)
+                printf("%02X", (int) meta->data[i]);
             printf("\n");
         }
     } else {
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _POSIX_C_SOURCE 199309L /* for clock_gettime */
+
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+
+void histogramInit(struct Histogram *hist, const char *name)
+{
+    memset(hist, 0, sizeof(struct Histogram));
+    hist->name = name;
+    hist->min = (uint64_t) -1;
+}
+
+void histogramAdd(struct Histogram *hist, uint64_t value)
+{
+    int bucket = 0;
+    uint64_t v;
+
+    for (v = value; v && bucket < HISTOGRAM_BUCKETS - 1; v >>= 1)
+        bucket++;
+    hist->buckets[bucket]++;
+
+    hist->count++;
+    hist->total += value;
+    if (value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+}
+
+void histogramPrint(FILE *to, struct Histogram *hist, const char *unit)
+{
+    int i;
+
+    if (hist->count == 0) {
+        fprintf(to, "%s: no samples\n", hist->name);
+        return;
+    }
+
+    fprintf(to, "%s: %llu samples, min %llu, mean %llu, max %llu %s\n", hist->name,
+        (unsigned long long) hist->count, (unsigned long long) hist->min,
+        (unsigned long long) (hist->total / hist->count),
+        (unsigned long long) hist->max, unit);
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (!hist->buckets[i]) continue;
+        if (i == 0) {
+            fprintf(to, "\t%21s", "0");
+        } else if (i == HISTOGRAM_BUCKETS - 1) {
+            fprintf(to, "\t%10llu-%10s", 1ULL << (i - 1), "");
+        } else {
+            fprintf(to, "\t%10llu-%10llu", 1ULL << (i - 1), (1ULL << i) - 1);
+        }
+        fprintf(to, " %s: %u\n", unit, (unsigned) hist->buckets[i]);
+    }
+}
+
+uint64_t histogramNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* bucket 0 is for 0, bucket i for [2^(i-1), 2^i), and the last bucket for
+ * everything larger */
+#define HISTOGRAM_BUCKETS 40
+
+/* a fixed-bucket histogram with log2 buckets. Adding never allocates or locks,
+ * so it can be used from the timer thread. Only one thread should add to a
+ * given histogram */
+struct Histogram {
+    const char *name;
+    uint64_t count, total, min, max;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/* initialize a histogram */
+void histogramInit(struct Histogram *hist, const char *name);
+
+/* add a value */
+void histogramAdd(struct Histogram *hist, uint64_t value);
+
+/* print it, with values in the given unit */
+void histogramPrint(FILE *to, struct Histogram *hist, const char *unit);
+
+/* the current monotonic time, in nanoseconds */
+uint64_t histogramNow(void);
+
+#endif
@@ -26,128 +26,389 @@
 
 #include "helpers.h"
 #include "midifile/midi.h"
-#include "midifile/midifile.h"
-#include "midifile/midifstream.h"
 #include "miditag.h"
-#include "pmhelpers.h"
+#include "smf.h"
 
-#define MAX_SIMUL 1024
+/* one input track being merged, with the next event read ahead */
+struct MergeInput {
+    struct SmfTrackReader *reader;
+    struct SmfEvent next;
+    int hasNext;
+};
 
-void merge(MfEvent **events, int *tracks, int sz);
+/* all of the events at one tick. Only this much is ever in memory */
+struct MergeGroup {
+    struct SmfEvent *events;
+    int *inputs; /* which input each event came from */
+    int ct, sz;
+
+    /* an open-addressing hash from merge keys to the event that later events
+     * with that key merge into. Entries are only valid if their generation is the current one, so
+     * it needn't be cleared for every tick */
+    uint32_t *hashKeys, *hashGens;
+    int *hashEvents;
+    uint32_t hashSz, gen;
+};
+
+/* how to merge events with the same key at the same tick */
+enum MergePolicy {
+    MERGE_KEEP = 0,     /* don't merge, keep them all */
+    MERGE_VELOCITY,     /* keep the first, with the last's velocity */
+    MERGE_LAST          /* keep the first's position, with the last's event */
+};
+
+/* merge policy for each channel message type, and whether data1 is part of
+ * its key (e.g. the note or controller number) */
+static const struct {
+    enum MergePolicy policy;
+    int keyData1;
+} channelPolicies[16] = {
+    {MERGE_KEEP, 0}, {MERGE_KEEP, 0}, {MERGE_KEEP, 0}, {MERGE_KEEP, 0},
+    {MERGE_KEEP, 0}, {MERGE_KEEP, 0}, {MERGE_KEEP, 0}, {MERGE_KEEP, 0},
+    /* MIDI_NOTE_OFF */             {MERGE_KEEP, 1},
+    /* MIDI_NOTE_ON */              {MERGE_VELOCITY, 1},
+    /* MIDI_NOTE_AFTERTOUCH */      {MERGE_KEEP, 1},
+    /* MIDI_CONTROLLER */           {MERGE_LAST, 1},
+    /* MIDI_PROGRAM_CHANGE */       {MERGE_KEEP, 0},
+    /* MIDI_CHANNEL_AFTERTOUCH */   {MERGE_KEEP, 0},
+    /* MIDI_PITCH_BEND */           {MERGE_LAST, 0},
+    /* sysex and metas */           {MERGE_KEEP, 0}
+};
+
+/* merge policy for metas (the meta type is part of the key) */
+static enum MergePolicy metaPolicy(uint8_t type)
+{
+    switch (type) {
+        case MIDI_M_TEMPO:
+        case MIDI_M_TIME_SIGNATURE:
+            return MERGE_LAST;
+
+        default:
+            return MERGE_KEEP;
+    }
+}
+
+/* a min-heap of inputs, ordered by their next event's tick, then by input
+ * number so that ties come out left to right */
+struct MergeHeap {
+    struct MergeInput *inputs;
+    int *heap;
+    int ct;
+};
+
+static void readNext(struct MergeInput *input, const char *filename);
+static void readGroup(struct MergeInput *input, int from, struct MergeGroup *group);
+static void writeGroup(struct SmfWriter *writer, struct MergeGroup *group);
+static void heapPush(struct MergeHeap *heap, int input);
+static int heapPop(struct MergeHeap *heap);
+void merge(struct MergeGroup *group);
 
 int main(int argc, char **argv)
 {
-    FILE *ifh1, *ifh2, *ofh;
-    PmError perr;
-    MfFile *imf1, *imf2, *omf;
-    MfStream *ims1, *ims2, *oms;
-    int rd, i;
-    MfEvent *events[MAX_SIMUL];
-    int tracks[MAX_SIMUL];
-    int writtenTag = 0;
+    struct SmfFile **imf;
+    struct SmfWriter *writer;
+    struct MergeInput *inputs;
+    struct MergeGroup group;
+    struct MergeHeap heap;
+    char **inFiles, *outFile, *header;
+    int inCt, trackCt, ti, i;
 
     if (argc < 4) {
-        fprintf(stderr, "Use: hmergemidis <input file 1> <input file 2> <output file>\n");
+        fprintf(stderr, "Use: hmergemidis <input file>... <output file>\n"
+                        "Later inputs are preferred when ambiguous.\n");
         return 1;
     }
+    inFiles = argv + 1;
+    inCt = argc - 2;
+    outFile = argv[argc-1];
 
-    PSF(perr, Mf_Initialize, ());
-
-    /* open them for input */
-    SF(ifh1, fopen, NULL, (argv[1], "rb"));
-    SF(ifh2, fopen, NULL, (argv[2], "rb"));
-
-    /* and read them in */
-    PSF(perr, Mf_ReadMidiFile, (&imf1, ifh1));
-    fclose(ifh1);
-    ims1 = Mf_OpenStream(imf1);
-    PSF(perr, Mf_ReadMidiFile, (&imf2, ifh2));
-    fclose(ifh2);
-    ims2 = Mf_OpenStream(imf2);
+    /* open them for input. We only read their headers and find their tracks
+     * here; the events are read as they're merged */
+    SF(imf, malloc, NULL, (inCt * sizeof(struct SmfFile *)));
+    for (i = 0; i < inCt; i++)
+        if (!(imf[i] = smfOpen(inFiles[i]))) return 1;
 
     /* make sure they're compatible */
-    if (imf1->timeDivision != imf2->timeDivision) {
-        fprintf(stderr, "The files must have the same time division.\n");
-        return 1;
+    for (i = 1; i < inCt; i++) {
+        if (imf[i]->timeDivision != imf[0]->timeDivision) {
+            fprintf(stderr, "The files must have the same time division.\n");
+            return 1;
+        }
     }
 
     /* prepare for output */
-    omf = Mf_NewFile(imf1->timeDivision);
-    oms = Mf_OpenStream(omf);
-
-    /* now perform the actual merge */
-    while (!Mf_StreamEmpty(ims1) || !Mf_StreamEmpty(ims2)) {
-        uint32_t t1, t;
-        t1 = Mf_StreamNext(ims1);
-        t = Mf_StreamNext(ims2);
-        if (t1 < t) t = t1;
-
-        if (t > 0 && !writtenTag) {
-            midiTagStreamHeader(oms, "hmergemidis ", NULL);
-            midiTagStreamFooter(oms);
-            writtenTag = 1;
+    trackCt = 1;
+    for (i = 0; i < inCt; i++)
+        if (imf[i]->trackCt > trackCt) trackCt = imf[i]->trackCt;
+    writer = smfWriterOpen(outFile, 1, trackCt, imf[0]->timeDivision);
+    memset(&group, 0, sizeof(group));
+    SF(inputs, calloc, NULL, (inCt, sizeof(struct MergeInput)));
+    heap.inputs = inputs;
+    SF(heap.heap, malloc, NULL, (inCt * sizeof(int)));
+
+    /* tracks only ever merge with the same track, so we can do it a track at
+     * a time, writing each out as we go */
+    for (ti = 0; ti < trackCt; ti++) {
+        int writtenTag = (ti != 0);
+
+        heap.ct = 0;
+        for (i = 0; i < inCt; i++) {
+            memset(&inputs[i], 0, sizeof(struct MergeInput));
+            if (ti < imf[i]->trackCt) {
+                inputs[i].reader = smfTrackOpen(imf[i], ti);
+                readNext(&inputs[i], inFiles[i]);
+                if (inputs[i].hasNext) heapPush(&heap, i);
+            }
         }
 
-        /* read all events at this time */
-        rd = Mf_StreamReadUntil(ims1, events, tracks, MAX_SIMUL, t);
-        rd += Mf_StreamReadUntil(ims2, events + rd, tracks + rd, MAX_SIMUL - rd, t);
+        smfWriterBeginTrack(writer);
+
+        /* now perform the actual merge */
+        while (heap.ct) {
+            uint32_t t = inputs[heap.heap[0]].next.tick;
 
-        /* merge them */
-        merge(events, tracks, rd);
+            if (t > 0 && !writtenTag) {
+                header = midiTagHeaderText("hmergemidis ", NULL);
+                smfWriterText(writer, 0, header);
+                smfWriterText(writer, 0, MIDI_TAG_FOOTER);
+                free(header);
+                writtenTag = 1;
+            }
 
-        /* then write them all out */
-        for (i = 0; i < rd; i++) {
-            /* don't write out track-end events, we'll add these ourselves */
-            if (!events[i]) continue;
-            if (events[i]->meta && events[i]->meta->type == 0x2F) {
-                Mf_FreeEvent(events[i]);
-                continue;
+            /* read all events at this time. The heap gives them to us in
+             * input order, so later inputs are merged over earlier ones */
+            group.ct = 0;
+            while (heap.ct && inputs[heap.heap[0]].next.tick == t) {
+                i = heapPop(&heap);
+                readGroup(&inputs[i], i, &group);
+                readNext(&inputs[i], inFiles[i]);
+                if (inputs[i].hasNext) heapPush(&heap, i);
             }
-            events[i]->deltaTm = events[i]->e.timestamp = 0;
-            PSF(perr, Mf_StreamWriteOne, (oms, tracks[i], events[i]));
+
+            /* merge them, then write them all out */
+            merge(&group);
+            writeGroup(writer, &group);
+        }
+
+        if (!writtenTag) {
+            header = midiTagHeaderText("hmergemidis ", NULL);
+            smfWriterText(writer, 0, header);
+            smfWriterText(writer, 0, MIDI_TAG_FOOTER);
+            free(header);
         }
+
+        smfWriterEndTrack(writer);
+
+        for (i = 0; i < inCt; i++)
+            if (inputs[i].reader) smfTrackClose(inputs[i].reader);
     }
 
     /* finalize them */
-    imf1 = Mf_CloseStream(ims1);
-    Mf_FreeFile(imf1);
-    imf2 = Mf_CloseStream(ims2);
-    Mf_FreeFile(imf2);
-    omf = Mf_CloseStream(oms);
-
-    /* write it out */
-    SF(ofh, fopen, NULL, (argv[3], "wb"));
-    PSF(perr, Mf_WriteMidiFile, (ofh, omf));
-    fclose(ofh);
-    Mf_FreeFile(omf);
+    free(group.events);
+    free(group.inputs);
+    free(group.hashKeys);
+    free(group.hashGens);
+    free(group.hashEvents);
+    free(heap.heap);
+    free(inputs);
+    for (i = 0; i < inCt; i++)
+        smfClose(imf[i]);
+    free(imf);
+    if (!smfWriterClose(writer)) {
+        fprintf(stderr, "Failed to write %s.\n", outFile);
+        return 1;
+    }
 
     return 0;
 }
 
-void merge(MfEvent **events, int *tracks, int sz)
+/* read the next event from an input, keeping our own copy of its bytes */
+static void readNext(struct MergeInput *input, const char *filename)
 {
-    int i, j;
-    uint8_t type1, type2, data11, data12;
-
-    for (i = 0; i < sz; i++) {
-        if (!events[i]) continue;
-        type1 = Pm_MessageType(events[i]->e.message);
-        data11 = Pm_MessageData1(events[i]->e.message);
-
-        for (j = i + 1; j < sz; j++) {
-            if (tracks[i] != tracks[j]) continue;
-            if (!events[j]) continue;
-            type2 = Pm_MessageType(events[j]->e.message);
-            data12 = Pm_MessageData1(events[j]->e.message);
-
-            if (type1 == type2 && data11 == data12) {
-                /* merge NOTE_ON events */
-                if (type1 == MIDI_NOTE_ON) {
-                    events[i]->e.message = events[j]->e.message;
-                    Mf_FreeEvent(events[j]);
-                    events[j] = NULL;
-                }
-            }
+    int rd;
+    unsigned char *bytes;
+
+    input->hasNext = 0;
+    if (!input->reader) return;
+
+    rd = smfTrackRead(input->reader, &input->next);
+    if (rd < 0) {
+        fprintf(stderr, "%s is corrupt.\n", filename);
+        exit(1);
+    }
+    if (rd == 0) return;
+
+    if (input->next.bytes) {
+        SF(bytes, malloc, NULL, (input->next.length + 1));
+        memcpy(bytes, input->next.bytes, input->next.length);
+        input->next.bytes = bytes;
+    }
+    input->hasNext = 1;
+}
+
+/* move an input's next event into the group */
+static void readGroup(struct MergeInput *input, int from, struct MergeGroup *group)
+{
+    if (group->ct >= group->sz) {
+        group->sz = group->sz ? group->sz * 2 : 64;
+        SF(group->events, realloc, NULL, (group->events, group->sz * sizeof(struct SmfEvent)));
+        SF(group->inputs, realloc, NULL, (group->inputs, group->sz * sizeof(int)));
+    }
+    group->inputs[group->ct] = from;
+    group->events[group->ct++] = input->next;
+    input->next.bytes = NULL;
+    input->hasNext = 0;
+}
+
+/* write out and free a group's events */
+static void writeGroup(struct SmfWriter *writer, struct MergeGroup *group)
+{
+    int i;
+
+    for (i = 0; i < group->ct; i++) {
+        struct SmfEvent *event = &group->events[i];
+        if (event->status) smfWriterEvent(writer, event);
+        free(event->bytes);
+    }
+}
+
+/* is input a before input b in the heap? */
+static int heapBefore(struct MergeHeap *heap, int a, int b)
+{
+    uint32_t ta = heap->inputs[a].next.tick, tb = heap->inputs[b].next.tick;
+    if (ta != tb) return ta < tb;
+    return a < b;
+}
+
+static void heapPush(struct MergeHeap *heap, int input)
+{
+    int i = heap->ct++, parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!heapBefore(heap, input, heap->heap[parent])) break;
+        heap->heap[i] = heap->heap[parent];
+        i = parent;
+    }
+    heap->heap[i] = input;
+}
+
+static int heapPop(struct MergeHeap *heap)
+{
+    int top = heap->heap[0], last, i = 0, child;
+
+    last = heap->heap[--heap->ct];
+    while ((child = i * 2 + 1) < heap->ct) {
+        if (child + 1 < heap->ct && heapBefore(heap, heap->heap[child+1], heap->heap[child]))
+            child++;
+        if (!heapBefore(heap, heap->heap[child], last)) break;
+        heap->heap[i] = heap->heap[child];
+        i = child;
+    }
+    heap->heap[i] = last;
+
+    return top;
+}
+
+/* get the merge policy and key for an event */
+static enum MergePolicy mergeKey(struct SmfEvent *event, uint32_t *key)
+{
+    enum MergePolicy policy;
+    uint8_t status = event->status, data1 = 0;
+
+    if (status == SMF_STATUS_META) {
+        policy = metaPolicy(event->metaType);
+        data1 = event->metaType;
+
+    } else {
+        /* a note on with velocity 0 is really a note off, and mustn't merge
+         * into a real note on */
+        if ((status >> 4) == MIDI_NOTE_ON && event->data[1] == 0)
+            status = (MIDI_NOTE_OFF << 4) | (status & 0xF);
+        policy = channelPolicies[status >> 4].policy;
+        if (channelPolicies[status >> 4].keyData1)
+            data1 = event->data[0];
+
+    }
+
+    /* the status includes the channel */
+    *key = ((uint32_t) status << 8) | data1;
+    return policy;
+}
+
+/* find the slot for this key, which is either empty or has the key */
+static uint32_t hashFind(struct MergeGroup *group, uint32_t key)
+{
+    uint32_t mask = group->hashSz - 1;
+    uint32_t slot = (key * 2654435761u) & mask;
+
+    while (group->hashGens[slot] == group->gen && group->hashKeys[slot] != key)
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+void merge(struct MergeGroup *group)
+{
+    int i;
+
+    /* keep the hash at most half full */
+    if (group->hashSz < (uint32_t) group->ct * 2) {
+        if (!group->hashSz) group->hashSz = 64;
+        while (group->hashSz < (uint32_t) group->ct * 2) group->hashSz *= 2;
+        free(group->hashKeys);
+        free(group->hashGens);
+        free(group->hashEvents);
+        SF(group->hashKeys, malloc, NULL, (group->hashSz * sizeof(uint32_t)));
+        SF(group->hashGens, calloc, NULL, (group->hashSz, sizeof(uint32_t)));
+        SF(group->hashEvents, malloc, NULL, (group->hashSz * sizeof(int)));
+        group->gen = 0;
+    }
+    if (++group->gen == 0) {
+        memset(group->hashGens, 0, group->hashSz * sizeof(uint32_t));
+        group->gen = 1;
+    }
+
+    for (i = 0; i < group->ct; i++) {
+        struct SmfEvent *event = &group->events[i], *first;
+        enum MergePolicy policy;
+        uint32_t key, slot;
+
+        policy = mergeKey(event, &key);
+        if (policy == MERGE_KEEP) continue;
+
+        slot = hashFind(group, key);
+        if (group->hashGens[slot] != group->gen) {
+            group->hashGens[slot] = group->gen;
+            group->hashKeys[slot] = key;
+            group->hashEvents[slot] = i;
+            continue;
+        }
+
+        /* only different inputs merge. Within one input, what happens at a
+         * tick is left as it was, and later inputs merge into its last event */
+        if (group->inputs[group->hashEvents[slot]] == group->inputs[i]) {
+            group->hashEvents[slot] = i;
+            continue;
+        }
+
+        /* merge it into the earlier event with this key, and drop it */
+        first = &group->events[group->hashEvents[slot]];
+        group->inputs[group->hashEvents[slot]] = group->inputs[i];
+        switch (policy) {
+            case MERGE_VELOCITY:
+                first->data[1] = event->data[1];
+                break;
+
+            case MERGE_LAST:
+                free(first->bytes);
+                *first = *event;
+                event->bytes = NULL;
+                break;
+
+            default:
+                break;
         }
+        event->status = 0; /* dropped */
     }
 }
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "capture.h"
+#include "helpers.h"
+#include "midifile/midi.h"
+
+/* start taps a second in, so there's time to get going */
+#define TAPS_START 1000
+
+/* tap length, in ms */
+#define TAPS_LENGTH 20
+
+int main(int argc, char **argv)
+{
+    FILE *f;
+    PmEvent *events;
+    int taps, interval, jitter = 0, i;
+
+    if (argc < 4) {
+        fprintf(stderr, "Use: hmktaps <capture file> <taps> <interval (ms)> [jitter (ms)]\n");
+        return 1;
+    }
+    taps = atoi(argv[2]);
+    interval = atoi(argv[3]);
+    if (argc > 4) jitter = atoi(argv[4]);
+    if (taps < 1 || interval <= TAPS_LENGTH + 2 * jitter || jitter < 0) {
+        fprintf(stderr, "The interval must be longer than a tap (%d ms) plus twice the jitter.\n", TAPS_LENGTH);
+        return 1;
+    }
+
+    /* always the same taps for the same arguments */
+    srand(0);
+
+    /* each tap is a note on and a note off */
+    SF(events, malloc, NULL, (taps * 2 * sizeof(PmEvent)));
+    for (i = 0; i < taps; i++) {
+        PmTimestamp ts = TAPS_START + i * interval;
+        if (jitter) ts += rand() % (2 * jitter + 1) - jitter;
+        events[i*2].timestamp = ts;
+        events[i*2].message = Pm_Message(Pm_MessageStatusGen(MIDI_NOTE_ON, 0), 60, 100);
+        events[i*2+1].timestamp = ts + TAPS_LENGTH;
+        events[i*2+1].message = Pm_Message(Pm_MessageStatusGen(MIDI_NOTE_ON, 0), 60, 0);
+    }
+
+    SF(f, fopen, NULL, (argv[1], "wb"));
+    captureWrite(f, 0, events, NULL, taps * 2);
+    fclose(f);
+    free(events);
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "midifile/midifile.h"
+#include "midiload.h"
+#include "passes.h"
+#include "pmhelpers.h"
+
+int main(int argc, char **argv)
+{
+    FILE *f;
+    PmError perr;
+    MfFile *pf;
+    struct PassStep *steps;
+    int stepCt;
+
+    if (argc < 4) {
+        fprintf(stderr, "Use: hpipeline <file> <output file> <pass>[,<pass>...]\n"
+                        "Passes:\n");
+        passesUsage(stderr);
+        return 1;
+    }
+
+    /* figure out what we're doing before we do any of it */
+    if ((stepCt = passesParse(argv[3], &steps)) < 0)
+        return 1;
+
+    PSF(perr, Mf_Initialize, ());
+
+    /* read it once */
+    if (!(pf = loadMidiFile(argv[1], 0))) return 1;
+
+    /* transform it */
+    pf = passesRun(pf, steps, stepCt);
+    passesFree(steps, stepCt);
+
+    /* and write it once */
+    SF(f, fopen, NULL, (argv[2], "wb"));
+    PSF(perr, Mf_WriteMidiFile, (f, pf));
+    fclose(f);
+    Mf_FreeFile(pf);
+
+    return 0;
+}
@@ -24,8 +24,14 @@
 #define HPLUGIN_H
 
 #define HUMIDITY_MAX_PLUGINS 64
+#define HUMIDITY_MAX_INPUTS 16
+#define HUMIDITY_MAX_OUTPUTS 16
+
+/* the input "device" when input is being replayed from a capture */
+#define HUMIDITY_REPLAY_DEVICE -2
 
 #include "midifile/midifstream.h"
+#include "noteindex.h"
 
 /* the overall state of humidity */
 struct HumidityState {
@@ -35,12 +41,62 @@ struct HumidityState {
     /* output file stream */
     MfStream *ofstream;
 
-    /* input/output device IDs */
+    /* input/output device IDs. There may be several of each, in which case
+     * idev and odev are the first */
     PmDeviceID idev, odev;
-
-    /* input and output device streams */
+    PmDeviceID idevs[HUMIDITY_MAX_INPUTS];
+    int idevCt;
+    PmDeviceID odevs[HUMIDITY_MAX_OUTPUTS];
+    int odevCt;
+
+    /* input and output device streams (all NULL when replaying). idstream and
+     * odstream are the first of idstreams and odstreams. Output is routed
+     * among the odstreams by the host */
     PortMidiStream *idstream;
+    PortMidiStream *idstreams[HUMIDITY_MAX_INPUTS];
     PortMidiStream *odstream;
+    PortMidiStream *odstreams[HUMIDITY_MAX_OUTPUTS];
+
+    /* the input events which arrived since the last tick, from all input
+     * devices in order of timestamp. The host reads these at the start of
+     * each tick, and every plugin sees all of them. inputSource is which
+     * input device each came from, counting -i options from 0. Plugins should
+     * use these instead of reading idstream directly, so that input can also
+     * come from a replayed capture */
+    PmEvent *input;
+    int *inputSource;
+    int32_t inputCt;
+
+    /* set by a plugin to the index in input of the event which released the
+     * notes it lets play this tick (such as a tap), if any. The host resets it
+     * to -1 each tick, and uses it to pair taps with their notes for
+     * --latency */
+    int32_t released;
+
+    /* read events from this tick's input, in the style of Pm_Read. Events
+     * read this way are consumed, so later plugins won't get them from
+     * readInput (they're still in input) */
+    int (*readInput)(struct HumidityState *hstate, PmEvent *buffer, int32_t length);
+
+    /* write a message to the output device, in the style of Pm_WriteShort.
+     * Plugins should use this instead of writing to odstream directly.
+     * Messages are collected and written together at the end of the tick,
+     * and while replaying are only accounted for. Returns 0 if there's no
+     * output device or the message had to be dropped */
+    int (*writeOutput)(struct HumidityState *hstate, PmMessage message);
+
+    /* the same, for a message which belongs to a track of the input file, so
+     * that it's routed (--route) along with the track's own events */
+    int (*writeOutputTrack)(struct HumidityState *hstate, int track, PmMessage message);
+
+    /* write an event or (short) meta event to the output file. From begin and
+     * the timer thread, plugins should use these instead of writing to
+     * ofstream directly: they only queue the event, without allocating or
+     * walking the output, and it goes through the same filtering as
+     * everything else. They return 0 if the event had to be dropped */
+    int (*writeEvent)(struct HumidityState *hstate, int track, uint32_t absoluteTm, PmMessage message);
+    int (*writeMeta)(struct HumidityState *hstate, int track, uint32_t absoluteTm,
+        uint8_t type, uint8_t length, const unsigned char *data);
 
     /* input MIDI file to read */
     char *ifile;
@@ -51,6 +107,10 @@ struct HumidityState {
     /* tick of the next note (note to wait for an event before playing) */
     int32_t nextTick;
 
+    /* index of the note-ons in each track of the input file, for finding the
+     * next note quickly (one per track) */
+    struct NoteIndex *noteIndex;
+
     /* any plugin-specific state */
     void *pstate[HUMIDITY_MAX_PLUGINS];
 };
@@ -50,6 +50,13 @@ PFUNC(int, tickWithMidi, (HS, PtTimestamp, uint32_t))
  * event to the output file, defaulting to 0 (no) */
 PFUNC(int, handleEvent, (HS, PtTimestamp, uint32_t, int, MfEvent *, int *))
 
+/* called with all the non-meta events at one tick at once, in place of
+ * handleEvent. The arguments are the number of events, the events, their
+ * tracks, whether to play each (initially 1; set it to 0 to quash an event)
+ * and whether to write each to the output file (initially 0). Quashed events
+ * are still passed to later plugins, so check play. Return value is ignored */
+PFUNC(int, handleEvents, (HS, PtTimestamp, uint32_t, int, MfEvent **, int *, int *, int *))
+
 /* called whenever a meta event is received. Return 1 to handle the event (only
  * tempo events are meaningfully handled by humidity itself, but other plugins
  * may care about other events), 0 to quash it. The last argument is whether to
@@ -24,57 +24,56 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "helpers.h"
-#include "midifile/midi.h"
-#include "midifile/midifile.h"
-#include "pmhelpers.h"
+#include "colfile.h"
+#include "passes.h"
+#include "velcurve.h"
 
 int main(int argc, char **argv)
 {
-    FILE *f;
-    PmError perr;
-    MfFile *pf;
-    int ti;
-    MfTrack *track;
-    MfEvent *cur;
-    int redux;
+    struct ColFile *cf;
+    struct VelMap *map;
+    int inPlace = 0, argi = 1, ret = 0;
+    char *ifile, *ofile = NULL;
 
-    if (argc < 4) {
-        fprintf(stderr, "Use: hreducevel <file> <output file> <range reduction>\n");
+    if (argc > 1 && !strcmp(argv[1], "--in-place")) {
+        inPlace = 1;
+        argi++;
+    }
+
+    if (argc < argi + (inPlace ? 2 : 3)) {
+        fprintf(stderr, "Use: hreducevel <file> <output file> <curve>...\n"
+                        "     hreducevel --in-place <file> <curve>...\n");
+        velMapUsage(stderr);
         return 1;
     }
-    redux = atoi(argv[3]);
+    ifile = argv[argi++];
+    if (!inPlace) ofile = argv[argi++];
+
+    /* build the velocity tables */
+    map = velMapNew();
+    for (; argi < argc; argi++)
+        if (!velMapParse(map, argv[argi])) return 1;
 
-    PSF(perr, Mf_Initialize, ());
+    if (inPlace) {
+        /* we can just patch the velocities in the file */
+        ret = smfPatch(ifile, patchVelMap, map) ? 0 : 1;
 
-    /* open it for input */
-    SF(f, fopen, NULL, (argv[1], "rb"));
+    } else {
+        /* read it */
+        if (!(cf = colFileLoad(ifile))) return 1;
 
-    /* and read it */
-    PSF(perr, Mf_ReadMidiFile, (&pf, f));
-    fclose(f);
+        /* redux it */
+        colPassVelMap(cf, map);
 
-    /* redux it */
-    for (ti = 0; ti < pf->trackCt; ti++) {
-        track = pf->tracks[ti];
-        cur = track->head;
-        while (cur) {
-            if (Pm_MessageType(cur->e.message) == MIDI_NOTE_ON) {
-                uint8_t vel = Pm_MessageData2(cur->e.message);
-                vel = 127 - (127-vel)/redux;
-                cur->e.message = Pm_Message(
-                    Pm_MessageStatus(cur->e.message),
-                    Pm_MessageData1(cur->e.message),
-                    vel);
-            }
-            cur = cur->next;
+        /* write it out */
+        if (!colFileWrite(cf, ofile)) {
+            fprintf(stderr, "Failed to write %s.\n", ofile);
+            ret = 1;
         }
-    }
+        colFileFree(cf);
 
-    /* write it out */
-    SF(f, fopen, NULL, (argv[2], "wb"));
-    PSF(perr, Mf_WriteMidiFile, (f, pf));
-    fclose(f);
+    }
 
-    return 0;
+    velMapFree(map);
+    return ret;
 }
@@ -24,104 +24,44 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "helpers.h"
-#include "midifile/midi.h"
-#include "midifile/midifile.h"
-#include "pmhelpers.h"
-
-uint8_t metro(uint8_t numer, uint8_t denom);
+#include "colfile.h"
+#include "passes.h"
 
 int main(int argc, char **argv)
 {
-    FILE *f;
-    PmError perr;
-    MfFile *pf;
-    int ti;
-    MfTrack *track;
-    MfEvent *cur;
+    struct ColFile *cf;
+    int inPlace = 0, argi = 1;
+    char *ifile, *ofile;
 
-    if (argc < 3) {
-        fprintf(stderr, "Use: htimesigfixer <file> <output file>\n");
-        return 1;
+    if (argc > 1 && !strcmp(argv[1], "--in-place")) {
+        inPlace = 1;
+        argi++;
     }
 
-    PSF(perr, Mf_Initialize, ());
+    if (argc < argi + (inPlace ? 1 : 2)) {
+        fprintf(stderr, "Use: htimesigfixer <file> <output file>\n"
+                        "     htimesigfixer --in-place <file>\n");
+        return 1;
+    }
+    ifile = argv[argi++];
 
-    /* open it for input */
-    SF(f, fopen, NULL, (argv[1], "rb"));
+    /* with --in-place, we can just patch the metronomes in the file */
+    if (inPlace)
+        return smfPatch(ifile, patchTimeSigFix, NULL) ? 0 : 1;
+    ofile = argv[argi++];
 
-    /* and read it */
-    PSF(perr, Mf_ReadMidiFile, (&pf, f));
-    fclose(f);
+    /* read it */
+    if (!(cf = colFileLoad(ifile))) return 1;
 
-    /* redux it */
-    for (ti = 0; ti < pf->trackCt; ti++) {
-        track = pf->tracks[ti];
-        cur = track->head;
-        while (cur) {
-            if (cur->meta && cur->meta->type == MIDI_M_TIME_SIGNATURE &&
-                cur->meta->length == MIDI_M_TIME_SIGNATURE_LENGTH) {
-                /* fix this time signature */
-                uint8_t numer = MIDI_M_TIME_SIGNATURE_NUMERATOR(cur->meta->data);
-                uint8_t denom = MIDI_M_TIME_SIGNATURE_DENOMINATOR(cur->meta->data);
-                MIDI_M_TIME_SIGNATURE_METRONOME(cur->meta->data) =
-                    metro(numer, denom);
-            }
-            cur = cur->next;
-        }
-    }
+    /* fix it */
+    colPassTimeSigFix(cf);
 
     /* write it out */
-    SF(f, fopen, NULL, (argv[2], "wb"));
-    PSF(perr, Mf_WriteMidiFile, (f, pf));
-    fclose(f);
+    if (!colFileWrite(cf, ofile)) {
+        fprintf(stderr, "Failed to write %s.\n", ofile);
+        return 1;
+    }
+    colFileFree(cf);
 
     return 0;
 }
-
-#define DENOM_TICKS (96>>denom)
-
-/* figure out a metronome value for the given time signature
- * for no good reason, this has some support for numerators up to 20 */
-uint8_t metro(uint8_t numer, uint8_t denom)
-{
-    switch (numer) {
-        case 0:
-        case 1:
-        case 2:
-        case 3:
-        case 4: /* common time and friends */
-        case 5:
-        case 7:
-        case 11:
-        case 13:
-        case 17:
-        case 19:
-            return DENOM_TICKS;
-
-        case 10:
-            return DENOM_TICKS * 2;
-
-        case 6:
-        case 9:
-        case 12:
-            return DENOM_TICKS * 3;
-
-        case 8:
-        case 16:
-            return DENOM_TICKS * 4;
-
-        case 15:
-        case 20:
-            return DENOM_TICKS * 5;
-
-        case 18:
-            return DENOM_TICKS * 6;
-
-        case 14:
-            return DENOM_TICKS * 7;
-
-        default:
-            return metro(numer/2, (denom>0)?(denom-1):0);
-    }
-}
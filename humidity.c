@@ -24,6 +24,8 @@
 
 #include <math.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,16 +33,37 @@
 #include <unistd.h>
 
 #include "args.h"
+#include "capture.h"
+#include "ccfilter.h"
+#include "eventpool.h"
 #include "helpers.h"
+#include "histogram.h"
 #include "hplugin.h"
 #include "midifile/midi.h"
 #include "midifile/midifstream.h"
+#include "midiload.h"
 #include "miditag.h"
+#include "outwriter.h"
 #include "pmhelpers.h"
+#include "ringbuffer.h"
 #include "whereami.h"
 
 #define METRO_PER_QN 24
 #define PLUGIN_FN_LEN 1024
+#define CAPTURE_BUFFER 65536
+#define OUTPUT_BUFFER 65536
+#define OUTPUT_DRAIN_INTERVAL 5 /* ms */
+#define OUTPUT_META_MAX 8
+#define TIMER_PERIOD 1000000 /* ns */
+#define LATENCY_PENDING 64
+#define INPUT_BATCH 256
+#define EVENT_BATCH 256
+#define CHORD_BATCH 1024
+#define OUTPUT_BATCH 256
+#define MAX_ROUTES 256
+#define SCHED_POLL_INTERVAL 1 /* ms */
+#define SCHED_MAX_SLEEP 10 /* ms */
+#define LATENCY_MAX 65536
 
 /* our overall state */
 static struct HumidityState globalHState;
@@ -48,11 +71,44 @@ static struct HumidityState globalHState;
 /* our currently loaded plugin */
 static int hplugins;
 static struct HumidityPlugin hplugin[HUMIDITY_MAX_PLUGINS];
+static const char *hpluginNames[HUMIDITY_MAX_PLUGINS];
+
+/* time spent in a plugin's hook (with --stats), in ns */
+struct HookTime {
+    uint64_t calls, total, max;
+};
+
+/* for each hook, the plugins which implement it, in order, so that calling a
+ * hook needn't check every plugin */
+#define PFUNC(type, nm, args) \
+static struct { \
+    hplugin_ ## nm ## _t func; \
+    int pnum; \
+    struct HookTime time; \
+} hdispatch_ ## nm[HUMIDITY_MAX_PLUGINS]; \
+static int hdispatch_ ## nm ## _ct = 0;
+#include "hplugin_functions.h"
+#undef PFUNC
+
+/* the plugins which handle non-meta events, one way or the other */
+static struct {
+    hplugin_handleEvents_t batch;
+    hplugin_handleEvent_t single;
+    int pnum;
+    struct HookTime time;
+} hdispatchEvents[HUMIDITY_MAX_PLUGINS];
+static int hdispatchEventsCt = 0;
+
 #define PCALL(var, cond, comb, f, args) do { \
-    int __hplugin_i; \
-    for (__hplugin_i = 0; __hplugin_i < hplugins; __hplugin_i++) { \
-        if (hplugin[__hplugin_i].f && cond) { \
-            (var) comb hplugin[__hplugin_i].f args; \
+    int __hplugin_d, __hplugin_i; \
+    for (__hplugin_d = 0; __hplugin_d < hdispatch_ ## f ## _ct && (cond); __hplugin_d++) { \
+        __hplugin_i = hdispatch_ ## f[__hplugin_d].pnum; \
+        if (showStats) { \
+            uint64_t __hplugin_tm = histogramNow(); \
+            (var) comb hdispatch_ ## f[__hplugin_d].func args; \
+            hookTimeAdd(&hdispatch_ ## f[__hplugin_d].time, histogramNow() - __hplugin_tm); \
+        } else { \
+            (var) comb hdispatch_ ## f[__hplugin_d].func args; \
         } \
     } \
 } while (0)
@@ -63,17 +119,205 @@ static int listDevices = 0;
 
 static int ready = 0;
 
+/* events to be written to the output file, queued by the timer thread for
+ * outputThread to write into ofstream */
+struct OutputRecord {
+    int32_t track;
+    uint32_t absoluteTm;
+    PmMessage message; /* MIDI_STATUS_META for metas */
+    uint8_t metaType, metaLength;
+    unsigned char metaData[OUTPUT_META_MAX];
+};
+static struct RingBuffer *outputRing = NULL;
+static pthread_t outputThreadId;
+static volatile int outputClosing = 0;
+static volatile uint32_t outputDropped = 0;
+
+/* the input file, once we're done with it */
+static MfFile *finishedInput = NULL;
+
+/* events for the output file come from here, so playback needn't allocate */
+static struct EventPool *eventPool = NULL;
+
+/* events we've played, to be freed when we're done (or by the decoding
+ * thread, with --lazy) rather than in the timer thread */
+static MfEvent *spentEvents = NULL;
+static size_t spentCt = 0;
+
+/* print statistics when we're done? */
+static int showStats = 0;
+
+/* statistics on the timer callback, in nanoseconds (except eventsPerTick),
+ * only gathered with --stats */
+static struct Histogram statPreMidi, statGetTick, statWithMidi, statReadLoop,
+    statWrite, statJitter, statEventsPerTick;
+static uint64_t lastTickTm = 0;
+#define STAT_START(tm) do { if (showStats) (tm) = histogramNow(); } while (0)
+#define STAT_END(hist, tm) do { if (showStats) histogramAdd(&(hist), histogramNow() - (tm)); } while (0)
+
+/* set by SIGUSR1 to ask the output thread to print statistics */
+static volatile sig_atomic_t statsRequested = 0;
+
+/* tap-to-output latency measurement (--latency). Taps are note-ons and
+ * controllers read from the input. A tap is answered by the first note-on
+ * written after a plugin reports (through hstate->released) that the tap
+ * released it, and taps which release nothing go unanswered. Latency is
+ * measured both in the timer's time (ms) and in processing time (ns). When
+ * replaying, the timer only steps a millisecond at a time, so only the
+ * processing time is worth a limit */
+struct LatencyTap {
+    uint32_t serial;
+    PtTimestamp timestamp;
+    uint64_t readTm;
+};
+static int measureLatency = 0;
+static int32_t latencyLimit = -1, processingLimit = -1;
+static struct LatencyTap pendingTaps[LATENCY_PENDING];
+static int pendingTapHead = 0, pendingTapCt = 0;
+static uint32_t inputSerial = 0, batchSerial = 0;
+static int tapReleased = 0;
+static uint32_t tapsMissed = 0;
+static PtTimestamp *tapLatencies = NULL;
+static uint64_t *tapProcessing = NULL;
+static int32_t tapCt = 0;
+
+/* run the handler from our own scheduler thread, only when there's something
+ * to do, rather than from the 1ms timer? */
+static int schedEvent = 0;
+static pthread_t schedThreadId;
+
+/* input is read once per tick, from the device or replay, into here */
+static int (*readRaw)(struct HumidityState *hstate, PmEvent *buffer, int *sources, int32_t length) = NULL;
+static PmEvent inputBatch[INPUT_BATCH];
+static int inputBatchSources[INPUT_BATCH];
+static int32_t inputBatchCur = 0;
+
+/* the (non-meta) events at one tick of the input file, gathered across reads
+ * so that a chord is never split. Allocated up front, and only grown if a
+ * chord is bigger than any yet */
+static MfEvent **chordEvents = NULL;
+static int *chordTracks = NULL, *chordPlay = NULL, *chordWriteOut = NULL;
+static int chordCt = 0, chordMax = 0;
+
+/* each input device's events, before merging */
+static PmEvent deviceBatch[HUMIDITY_MAX_INPUTS][INPUT_BATCH];
+
+/* output to each device is collected here, and written once per tick */
+struct OutputQueue {
+    PmEvent events[OUTPUT_BATCH];
+    int32_t ct;
+    PtTimestamp lastTs; /* with an output latency, timestamps never go back */
+};
+static struct OutputQueue outputQueues[HUMIDITY_MAX_OUTPUTS];
+static uint32_t outputBatchDropped = 0;
+
+/* routing of tracks and channels to output devices (--route). Each rule sends
+ * a track (-1 for all) and channel (-1 for all) to an output, and later rules
+ * win. The table has a row of 16 channels for output without a track, then a
+ * row for each track */
+struct OutputRoute {
+    int track, channel, output;
+};
+static struct OutputRoute routes[MAX_ROUTES];
+static int routeCt = 0;
+static unsigned char *routeTable = NULL;
+static int routeTracks = 0;
+
+/* filtering of redundant and too-dense controller messages (--cc-filter), on
+ * each output device (in ms) and each track of the output file (in ticks).
+ * ccInterval is -1 when not filtering */
+static int32_t ccInterval = -1;
+static struct CCFilter *liveFilter = NULL, *fileFilter = NULL;
+
+/* output latency and lookahead (ms). With an output latency, each event
+ * played from the file is timestamped with exactly when its tick falls, and
+ * the driver plays it that long after, rather than when the callback happened
+ * to run. Events up to lookahead ahead of the callback are played early with
+ * their future timestamps */
+static int32_t outputLatency = 0, outputLookahead = 0;
+
+/* a point of known time in the input file, for timestamping ticks */
+static PtTimestamp anchorTs = 0;
+static uint32_t anchorTick = 0;
+
+/* the timestamp of the current timer callback */
+static PtTimestamp curTimestamp = 0;
+
+static int exitStatus = 0;
+
+/* writes our output file once we're done */
+static struct OutputWriter outputWriter;
+
+/* number of tracks in the note index */
+static int noteIndexCt = 0;
+
+/* replay input from a capture instead of running live? */
+static char *replayFile = NULL;
+static PmEvent *replayEvents = NULL;
+static int *replaySources = NULL;
+static int32_t replayCt = 0, replayCur = 0;
+static PtTimestamp replayNow = 0;
+
+/* capture the live input? */
+static char *captureFile = NULL;
+static struct CaptureWriter *captureWriter = NULL;
+
+/* decode the input file lazily, only a little ahead of playback? */
+static int lazyLoad = 0;
+static struct LazyFile *lazyInput = NULL;
+
 /* functions */
 void hostArg(struct HumidityState *hstate, int *argi, char **argv);
 void loadPlugin(struct HumidityState *hstate, char *bindir, char *pluginNm);
 void usage(struct HumidityState *hstate);
 void handler(PtTimestamp timestamp, void *vphstate);
+void tick(struct HumidityState *hstate, PtTimestamp timestamp);
+void handleMeta(struct HumidityState *hstate, PtTimestamp timestamp, uint32_t tmTick,
+    int rtrack, MfEvent *event);
+void handleChord(struct HumidityState *hstate, PtTimestamp timestamp, uint32_t tmTick);
+void chordGrow(int max);
+void replay(struct HumidityState *hstate);
+void finish(struct HumidityState *hstate);
+void finished(void *vphstate);
+void freeSpentEvents(void);
+void freeOutput(MfFile *file, void *vphstate);
+void printStats(void);
+void hookTimeAdd(struct HookTime *time, uint64_t ns);
+void printHookTime(const char *hook, int pnum, struct HookTime *time);
+void statsSignal(int sig);
+int readDevice(struct HumidityState *hstate, PmEvent *buffer, int *sources, int32_t length);
+int readReplay(struct HumidityState *hstate, PmEvent *buffer, int *sources, int32_t length);
+int inputWaiting(struct HumidityState *hstate);
+int readBatch(struct HumidityState *hstate, PmEvent *buffer, int32_t length);
+int writeDevice(struct HumidityState *hstate, PmMessage message);
+int writeDeviceTrack(struct HumidityState *hstate, int track, PmMessage message);
+int writeDeviceAt(struct HumidityState *hstate, int track, PmMessage message, PtTimestamp timestamp);
+void flushQueue(struct HumidityState *hstate, int output);
+void queueOutput(struct HumidityState *hstate, int output, PmMessage message, PtTimestamp timestamp);
+void parseRoute(struct HumidityState *hstate, char *route);
+void buildRoutes(int trackCt);
+int routeOutput(int track, PmMessage message);
+PtTimestamp tickTimestamp(struct HumidityState *hstate, uint32_t tick);
+void flushOutput(struct HumidityState *hstate);
+void addTaps(PmEvent *events, int32_t ct);
+void releaseTap(struct HumidityState *hstate);
+void printLatency(void);
+int writeEvent(struct HumidityState *hstate, int track, uint32_t absoluteTm, PmMessage message);
+int writeMeta(struct HumidityState *hstate, int track, uint32_t absoluteTm,
+    uint8_t type, uint8_t length, const unsigned char *data);
+void *outputThread(void *vphstate);
+void writeRecord(struct HumidityState *hstate, struct OutputRecord *rec);
+void filterRecord(struct HumidityState *hstate, struct OutputRecord *rec);
+int pushRecord(struct OutputRecord *rec);
+void *schedThread(void *vphstate);
+PtTimestamp schedDelay(struct HumidityState *hstate, PtTimestamp now);
 
 int main(int argc, char **argv)
 {
     FILE *f;
     PmError perr;
     PtError pterr;
+    PtTimestamp startTs;
     MfFile *pf, *of;
     int argir, *argi, i;
     char *dir, *fil;
@@ -81,6 +325,12 @@ int main(int argc, char **argv)
 
     whereAmI(argv[0], &dir, &fil);
     hstate->idev = hstate->odev = hstate->nextTick = -1;
+    hstate->readInput = readBatch;
+    readRaw = readDevice;
+    hstate->writeOutput = writeDevice;
+    hstate->writeOutputTrack = writeDeviceTrack;
+    hstate->writeEvent = writeEvent;
+    hstate->writeMeta = writeMeta;
 
     argi = &argir;
     for (argir = 1; argir < argc;) {
@@ -96,9 +346,22 @@ int main(int argc, char **argv)
         }
     }
 
+    /* when replaying, we drive the handler ourselves */
+    if (replayFile) {
+        SF(f, fopen, NULL, (replayFile, "rb"));
+        replayCt = captureRead(f, &replayNow, &replayEvents, &replaySources);
+        fclose(f);
+        if (replayCt < 0) {
+            fprintf(stderr, "%s is not a valid capture.\n", replayFile);
+            exit(1);
+        }
+        hstate->idev = HUMIDITY_REPLAY_DEVICE;
+        readRaw = readReplay;
+    }
+
     PSF(perr, Pm_Initialize, ());
     PSF(perr, Mf_Initialize, ());
-    PTSF(pterr, Pt_Start, (1, handler, (void *) hstate));
+    PTSF(pterr, Pt_Start, (1, (replayFile || schedEvent) ? NULL : handler, (void *) hstate));
 
     /* list devices */
     if (listDevices) {
@@ -118,11 +381,16 @@ int main(int argc, char **argv)
     }
 
     /* choose device */
-    if (hstate->odev == -1) {
+    if (hstate->odev == -1 && !replayFile) {
         usage(hstate);
         exit(1);
     }
 
+    if (outputLookahead > outputLatency) {
+        fprintf(stderr, "The lookahead cannot exceed the output latency.\n");
+        exit(1);
+    }
+
     /* check files */
     if (!hstate->ifile || !hstate->ofile) {
         usage(hstate);
@@ -130,24 +398,100 @@ int main(int argc, char **argv)
     }
 
     /* open it for input/output */
-    if (hstate->idev >= 0) PSF(perr, Pm_OpenInput, (&hstate->idstream, hstate->idev, NULL, 1024, NULL, NULL));
-    PSF(perr, Pm_OpenOutput, (&hstate->odstream, hstate->odev, NULL, 1024, NULL, NULL, 0));
+    if (!replayFile) {
+        for (i = 0; i < hstate->idevCt; i++)
+            PSF(perr, Pm_OpenInput, (&hstate->idstreams[i], hstate->idevs[i], NULL, 1024, NULL, NULL));
+        hstate->idstream = hstate->idstreams[0];
+        for (i = 0; i < hstate->odevCt; i++)
+            PSF(perr, Pm_OpenOutput, (&hstate->odstreams[i], hstate->odevs[i], NULL, 1024, NULL, NULL, outputLatency));
+        hstate->odstream = hstate->odstreams[0];
+    }
 
-    /* open the file for input */
-    SF(f, fopen, NULL, (hstate->ifile, "rb"));
+    /* read the file, decoding its tracks in parallel, or just get ready to
+     * decode it as we play it */
+    if (lazyLoad) {
+        if (!(lazyInput = lazyFileOpen(hstate->ifile))) return 1;
+        pf = lazyInput->file;
+    } else {
+        if (!(pf = loadMidiFile(hstate->ifile, 0))) return 1;
+    }
 
-    /* and read it */
-    PSF(perr, Mf_ReadMidiFile, (&pf, f));
-    fclose(f);
+    /* now that we know how many tracks there are, we can route them */
+    for (i = 0; i < routeCt; i++) {
+        if (!replayFile && routes[i].output >= hstate->odevCt) {
+            fprintf(stderr, "Route to output %d, but there are only %d outputs.\n",
+                routes[i].output, hstate->odevCt);
+            exit(1);
+        }
+    }
+    buildRoutes(pf->trackCt);
+
+    /* the file's filter works in ticks, taking 120BPM as typical */
+    if (ccInterval >= 0) {
+        uint32_t ticks = 0;
+        if (!(pf->timeDivision & 0x8000))
+            ticks = (uint32_t) ccInterval * pf->timeDivision / 500;
+        liveFilter = ccFilterNew(hstate->odevCt ? hstate->odevCt : 1, ccInterval);
+        fileFilter = ccFilterNew(pf->trackCt, ticks);
+    }
 
     /* open everything in streaming mode */
     hstate->ifstream = Mf_OpenStream(pf);
-    Mf_StartStream(hstate->ifstream, Pt_Time());
+    startTs = replayFile ? replayNow : Pt_Time();
+    Mf_StartStream(hstate->ifstream, startTs);
+    if (captureFile && hstate->idstream) {
+        FILE *cf;
+        SF(cf, fopen, NULL, (captureFile, "wb"));
+        captureWriter = captureWriterOpen(cf, startTs, CAPTURE_BUFFER);
+    }
     of = Mf_NewFile(pf->timeDivision);
     while (of->tracks < pf->tracks)
         Mf_NewTrack(of);
     hstate->ofstream = Mf_OpenStream(of);
 
+    /* index the notes, so plugins needn't walk the tracks to find them */
+    hstate->noteIndex = lazyInput ? lazyInput->notes->indices : noteIndexBuild(pf);
+    noteIndexCt = pf->trackCt;
+
+    /* the output will have roughly an event for each input event, plus
+     * whatever the plugins add, so size our pool accordingly */
+    {
+        size_t eventCt = 0;
+        int ti;
+        MfEvent *cur;
+        if (lazyInput) {
+            /* we can't count them, but an event is at least three bytes */
+            for (ti = 0; ti < lazyInput->smf->trackCt; ti++)
+                eventCt += lazyInput->smf->trackLengths[ti] / 3;
+        } else {
+            for (ti = 0; ti < pf->trackCt; ti++)
+                for (cur = pf->tracks[ti]->head; cur; cur = cur->next)
+                    eventCt++;
+        }
+        eventPool = eventPoolNew(eventCt * 2, eventCt, OUTPUT_META_MAX);
+    }
+
+    chordGrow(CHORD_BATCH);
+
+    if (showStats) {
+        histogramInit(&statPreMidi, "tickPreMidi");
+        histogramInit(&statGetTick, "Mf_StreamGetTick");
+        histogramInit(&statWithMidi, "tickWithMidi");
+        histogramInit(&statReadLoop, "Event loop");
+        histogramInit(&statWrite, "Pm_Write");
+        histogramInit(&statJitter, "Timer jitter");
+        histogramInit(&statEventsPerTick, "Events per tick");
+        signal(SIGUSR1, statsSignal);
+    }
+    if (measureLatency) {
+        SF(tapLatencies, malloc, NULL, (LATENCY_MAX * sizeof(PtTimestamp)));
+        SF(tapProcessing, malloc, NULL, (LATENCY_MAX * sizeof(uint64_t)));
+    }
+
+    /* get ready to write out the output when we're done */
+    outputWriterStart(&outputWriter, hstate->ofile, finished, (void *) hstate);
+    outputWriter.freeFile = freeOutput;
+
     /* write a comment at the beginning for our version */
     midiTagStreamHeader(hstate->ofstream, NULL, ", plugins:");
 
@@ -160,15 +504,37 @@ int main(int argc, char **argv)
 
     /* then write our URL, to bracket any comments added by the plugins */
     midiTagStreamFooter(hstate->ofstream);
+    flushOutput(hstate);
+
+    /* from here on, ofstream belongs to the output thread */
+    outputRing = ringBufferNew(sizeof(struct OutputRecord), OUTPUT_BUFFER);
+    i = pthread_create(&outputThreadId, NULL, outputThread, (void *) hstate);
+    if (i != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(i));
+        exit(1);
+    }
 
     ready = 1;
 
+    if (schedEvent && !replayFile) {
+        i = pthread_create(&schedThreadId, NULL, schedThread, (void *) hstate);
+        if (i != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(i));
+            exit(1);
+        }
+    }
+
+    /* replaying is its own main loop */
+    if (replayFile) replay(hstate);
+
     /* do some sort of main loop */
     i = 0;
     PCALL(i, !i, |=, mainLoop, (PA));
-    if (!i) while (1) Pt_Sleep(1<<30);
 
-    return 1; /* shouldn't get here */
+    /* or just wait for the output to be written */
+    outputWriterJoin(&outputWriter);
+
+    return exitStatus;
 }
 
 void hostArg(struct HumidityState *hstate, int *argi, char **argv)
@@ -178,10 +544,69 @@ void hostArg(struct HumidityState *hstate, int *argi, char **argv)
         listDevices = 1;
 
     } else ARGN(i, input-device) {
-        hstate->idev = atoi(argv[++*argi]);
+        if (hstate->idevCt >= HUMIDITY_MAX_INPUTS) {
+            fprintf(stderr, "Too many input devices!\n");
+            exit(1);
+        }
+        hstate->idevs[hstate->idevCt++] = atoi(argv[++*argi]);
+        hstate->idev = hstate->idevs[0];
 
     } else ARGN(o, output-device) {
-        hstate->odev = atoi(argv[++*argi]);
+        if (hstate->odevCt >= HUMIDITY_MAX_OUTPUTS) {
+            fprintf(stderr, "Too many output devices!\n");
+            exit(1);
+        }
+        hstate->odevs[hstate->odevCt++] = atoi(argv[++*argi]);
+        hstate->odev = hstate->odevs[0];
+
+    } else ARGLN(cc-filter) {
+        ccInterval = atoi(argv[++*argi]);
+        if (ccInterval < 0) ccInterval = 0;
+
+    } else ARGLN(route) {
+        parseRoute(hstate, argv[++*argi]);
+
+    } else ARGN(L, output-latency) {
+        outputLatency = atoi(argv[++*argi]);
+        if (outputLatency < 0) outputLatency = 0;
+
+    } else ARGLN(lookahead) {
+        outputLookahead = atoi(argv[++*argi]);
+        if (outputLookahead < 0) outputLookahead = 0;
+
+    } else ARGLN(replay) {
+        replayFile = argv[++*argi];
+
+    } else ARGLN(capture) {
+        captureFile = argv[++*argi];
+
+    } else ARGLN(sched) {
+        char *sched = argv[++*argi];
+        if (!strcmp(sched, "event")) {
+            schedEvent = 1;
+        } else if (!strcmp(sched, "timer")) {
+            schedEvent = 0;
+        } else {
+            usage(hstate);
+            exit(1);
+        }
+
+    } else ARGL(lazy) {
+        lazyLoad = 1;
+
+    } else ARGL(stats) {
+        showStats = 1;
+
+    } else ARGL(latency) {
+        measureLatency = 1;
+
+    } else ARGLN(latency-limit) {
+        measureLatency = 1;
+        latencyLimit = atoi(argv[++*argi]);
+
+    } else ARGLN(processing-limit) {
+        measureLatency = 1;
+        processingLimit = atoi(argv[++*argi]);
 
     } else if (arg[0] == '-') {
         usage(hstate);
@@ -218,6 +643,22 @@ void loadPluginFuncs(struct HumidityState *hstate, void *plugin)
 #include "hplugin_functions.h"
 #undef PFUNC
 
+    /* add it to the dispatch for each hook it implements */
+#define PFUNC(type, nm, args) \
+    if (hplugin[hplugins].nm) { \
+        hdispatch_ ## nm[hdispatch_ ## nm ## _ct].func = hplugin[hplugins].nm; \
+        hdispatch_ ## nm[hdispatch_ ## nm ## _ct].pnum = hplugins; \
+        hdispatch_ ## nm ## _ct++; \
+    }
+#include "hplugin_functions.h"
+#undef PFUNC
+    if (hplugin[hplugins].handleEvents || hplugin[hplugins].handleEvent) {
+        hdispatchEvents[hdispatchEventsCt].batch = hplugin[hplugins].handleEvents;
+        hdispatchEvents[hdispatchEventsCt].single = hplugin[hplugins].handleEvent;
+        hdispatchEvents[hdispatchEventsCt].pnum = hplugins;
+        hdispatchEventsCt++;
+    }
+
     if (hplugin[hplugins].init) {
         /* call its initializer */
         hplugin[hplugins].init(hstate, hplugins);
@@ -231,6 +672,12 @@ void loadPlugin(struct HumidityState *hstate, char *bindir, char *pluginNm)
     char pluginFn[PLUGIN_FN_LEN];
     void *plugin;
 
+    if (hplugins >= HUMIDITY_MAX_PLUGINS) {
+        fprintf(stderr, "Too many plugins!\n");
+        exit(1);
+    }
+    hpluginNames[hplugins] = pluginNm;
+
     snprintf(pluginFn, PLUGIN_FN_LEN, "%s/%s.so", bindir, pluginNm);
     if (tryLoadPlugin(&plugin, pluginFn)) { loadPluginFuncs(hstate, plugin); return; }
 
@@ -245,92 +692,927 @@ void usage(struct HumidityState *hstate)
 {
     int pusage = 0;
     fprintf(stderr, "Usage: humidity -o <output device> -p <plugin> [plugin options] <input file> <output file>\n"
-                    "       humidity -l: List devices\n");
+                    "       humidity --replay <capture> -p <plugin> [plugin options] <input file> <output file>\n"
+                    "       humidity -l: List devices\n"
+                    "Host options:\n"
+                    "\t-i|--input-device <device>: Take input from this device. May be given\n"
+                    "\t                            more than once, to merge several inputs.\n"
+                    "\t-o|--output-device <device>: Send output to this device. May be given\n"
+                    "\t                             more than once, with --route.\n"
+                    "\t--route <track>:<channel>=<output>: Send a track's events on a channel\n"
+                    "\t                                   (1-16) to the nth output device (from\n"
+                    "\t                                   0). Either may be *, for all.\n"
+                    "\t--cc-filter <ms>: Drop controller messages which don't change anything,\n"
+                    "\t                  and send at most one change per controller every\n"
+                    "\t                  <ms> (0 for no limit), to devices and the output file.\n"
+                    "\t--capture <file>: Record the input devices' events for --replay.\n"
+                    "\t-L|--output-latency <ms>: Schedule output this far ahead, with each\n"
+                    "\t                           event timestamped by the tempo.\n"
+                    "\t--lookahead <ms>: With -L, play events up to this far ahead early.\n"
+                    "\t--sched <timer|event>: Run every millisecond (timer, the default), or\n"
+                    "\t                        only when input or the file needs it (event).\n"
+                    "\t--lazy: Decode the input file as it's played, rather than all at\n"
+                    "\t        once, so that memory use doesn't grow with its size.\n"
+                    "\t--stats: Print statistics when done, or on SIGUSR1.\n"
+                    "\t--latency: Measure the latency from each tap to the note it released.\n"
+                    "\t--latency-limit <ms>: Measure latency, and fail if the 99th percentile\n"
+                    "\t                      exceeds the limit.\n"
+                    "\t--processing-limit <us>: Measure latency, and fail if the 99th\n"
+                    "\t                         percentile of processing time exceeds the\n"
+                    "\t                         limit. Use this with --replay.\n");
     PCALL(pusage, 1, |=, usage, (PA));
 }
 
 void handler(PtTimestamp timestamp, void *vphstate)
 {
-    MfEvent *event;
-    int rtrack, tmpi, writeOut;
-    uint32_t tmTick;
+    int32_t ct;
+    uint64_t statTm = 0;
     struct HumidityState *hstate = (struct HumidityState *) vphstate;
 
+    curTimestamp = timestamp;
     if (!ready) return;
 
+    /* how late were we? (meaningless when replaying, since we set the pace) */
+    if (showStats && !replayFile && !schedEvent) {
+        statTm = histogramNow();
+        if (lastTickTm) {
+            uint64_t period = statTm - lastTickTm;
+            histogramAdd(&statJitter,
+                (period > TIMER_PERIOD) ? period - TIMER_PERIOD : TIMER_PERIOD - period);
+        }
+        lastTickTm = statTm;
+    }
+
+    /* read all the input we have for this tick at once */
+    ct = readRaw(hstate, inputBatch, inputBatchSources, INPUT_BATCH);
+    hstate->input = inputBatch;
+    hstate->inputSource = inputBatchSources;
+    hstate->inputCt = (ct > 0) ? ct : 0;
+    hstate->released = -1;
+    inputBatchCur = 0;
+
+    tick(hstate, timestamp);
+
+    /* and write all our output at once */
+    if (ready) {
+        STAT_START(statTm);
+        flushOutput(hstate);
+        STAT_END(statWrite, statTm);
+    }
+}
+
+/* a tick of the handler, with input already read */
+void tick(struct HumidityState *hstate, PtTimestamp timestamp)
+{
+    MfEvent *events[EVENT_BATCH];
+    int rtracks[EVENT_BATCH];
+    int ct, i, tmpi;
+    uint32_t tmTick, readTick, eventCt = 0;
+    uint64_t statTm = 0, statLoopTm = 0;
+
     /* call pre-MIDI stuff */
     tmpi = 1;
+    STAT_START(statTm);
     PCALL(tmpi, tmpi, &=, tickPreMidi, (PA, timestamp));
+    STAT_END(statPreMidi, statTm);
+    if (measureLatency) releaseTap(hstate);
     if (!tmpi) return;
 
     /* don't do anything if we shouldn't start yet */
     if (hstate->nextTick <= 0) return;
 
     /* figure out when to read to */
+    STAT_START(statTm);
     tmTick = Mf_StreamGetTick(hstate->ifstream, timestamp);
+    STAT_END(statGetTick, statTm);
     if (tmTick >= hstate->nextTick) tmTick = hstate->nextTick - 1;
 
     /* now that we know where we are, tell the plugins */
     tmpi = 1;
+    STAT_START(statTm);
     PCALL(tmpi, tmpi, &=, tickWithMidi, (PA, timestamp, tmTick));
+    STAT_END(statWithMidi, statTm);
     if (!tmpi) return;
 
-    while (Mf_StreamReadUntil(hstate->ifstream, &event, &rtrack, 1, tmTick) == 1) {
-        if (event->meta) {
-            /* perhaps a plugin will handle this event */
-            writeOut = 0;
-            tmpi = 1;
-            PCALL(tmpi, tmpi, &=, handleMetaEvent, (PA, timestamp, tmTick, rtrack, event, &writeOut));
-            if (tmpi) {
-                if (event->meta->type == MIDI_M_TEMPO &&
-                        event->meta->length == MIDI_M_TEMPO_LENGTH) {
-                    PtTimestamp ts;
-                    uint32_t tempo = MIDI_M_TEMPO_N(event->meta->data);
-                    Mf_StreamSetTempoTick(hstate->ifstream, &ts, event->absoluteTm, tempo);
-                }
-
-                if (writeOut) {
-                    fprintf(stderr, "FIXME: writeOut for handleMetaEvent currently not supported.\n");
-                    exit(1);
-                }
+    /* read ahead if we're timestamping output */
+    readTick = tmTick;
+    if (outputLatency) {
+        anchorTs = timestamp;
+        anchorTick = Mf_StreamGetTick(hstate->ifstream, timestamp);
+        if (outputLookahead) {
+            readTick = Mf_StreamGetTick(hstate->ifstream, timestamp + outputLookahead);
+            if (readTick >= hstate->nextTick) readTick = hstate->nextTick - 1;
+            if (readTick < tmTick) readTick = tmTick;
+        }
+    }
+
+    /* take what's been decoded of the file, and if decoding has fallen
+     * behind, wait for it rather than skip anything */
+    if (lazyInput) {
+        uint32_t horizon = lazyFileTake(lazyInput, readTick);
+        if (readTick > horizon) readTick = horizon;
+    }
+
+    STAT_START(statLoopTm);
+    do {
+        ct = Mf_StreamReadUntil(hstate->ifstream, events, rtracks, EVENT_BATCH, readTick);
+
+        for (i = 0; i < ct; i++) {
+            /* a later event means the chord before it is done */
+            if (chordCt && events[i]->absoluteTm != chordEvents[0]->absoluteTm)
+                handleChord(hstate, timestamp, tmTick);
+
+            if (events[i]->meta) {
+                /* metas at the chord's own tick don't break it up */
+                handleMeta(hstate, timestamp, tmTick, rtracks[i], events[i]);
+
+            } else {
+                /* all the events at this tick together, even across reads */
+                if (chordCt == chordMax) chordGrow(chordMax * 2);
+                chordEvents[chordCt] = events[i];
+                chordTracks[chordCt++] = rtracks[i];
+
             }
+        }
+
+        /* free them later, we don't want to touch the heap here */
+        for (i = 0; i < ct; i++) {
+            events[i]->next = spentEvents;
+            spentEvents = events[i];
+        }
+        spentCt += (ct > 0) ? ct : 0;
+        eventCt += (ct > 0) ? ct : 0;
+    } while (ct == EVENT_BATCH);
+    if (chordCt) handleChord(hstate, timestamp, tmTick);
+    STAT_END(statReadLoop, statLoopTm);
+
+    /* when decoding lazily, the decoding thread frees them */
+    if (lazyInput && spentEvents && lazyFileRecycle(lazyInput, spentEvents))
+        spentEvents = NULL;
+    if (showStats) histogramAdd(&statEventsPerTick, eventCt);
+
+    if (Mf_StreamEmpty(hstate->ifstream) == TRUE) {
+        flushOutput(hstate);
+        finish(hstate);
+    }
+}
+
+/* handle a meta event from the input file */
+void handleMeta(struct HumidityState *hstate, PtTimestamp timestamp, uint32_t tmTick,
+    int rtrack, MfEvent *event)
+{
+    int tmpi, writeOut;
+
+    /* perhaps a plugin will handle this event */
+    writeOut = 0;
+    tmpi = 1;
+    PCALL(tmpi, tmpi, &=, handleMetaEvent, (PA, timestamp, tmTick, rtrack, event, &writeOut));
+    if (tmpi) {
+        if (event->meta->type == MIDI_M_TEMPO &&
+                event->meta->length == MIDI_M_TEMPO_LENGTH) {
+            PtTimestamp ts;
+            uint32_t tempo = MIDI_M_TEMPO_N(event->meta->data);
+            Mf_StreamSetTempoTick(hstate->ifstream, &ts, event->absoluteTm, tempo);
+
+            /* later ticks are timed from here */
+            anchorTs = ts;
+            anchorTick = event->absoluteTm;
+        }
+
+        if (writeOut) {
+            fprintf(stderr, "FIXME: writeOut for handleMetaEvent currently not supported.\n");
+            exit(1);
+        }
+    }
+}
+
+/* handle the gathered (non-meta) events at one tick of the input file, and
+ * empty the chord. Plugins with handleEvents get them all at once, others one
+ * by one */
+void handleChord(struct HumidityState *hstate, PtTimestamp timestamp, uint32_t tmTick)
+{
+    MfEvent **events = chordEvents;
+    int *rtracks = chordTracks, *play = chordPlay, *writeOut = chordWriteOut;
+    int count = chordCt;
+    int d, p, i;
+    uint64_t tm = 0;
+    PtTimestamp ts;
+
+    for (i = 0; i < count; i++) {
+        play[i] = 1;
+        writeOut[i] = 0;
+    }
+
+    /* perhaps the plugins will handle these events */
+    for (d = 0; d < hdispatchEventsCt; d++) {
+        p = hdispatchEvents[d].pnum;
+        STAT_START(tm);
+        if (hdispatchEvents[d].batch) {
+            hdispatchEvents[d].batch(hstate, p, timestamp, tmTick, count, events, rtracks, play, writeOut);
 
         } else {
-            /* perhaps a plugin will handle this event */
-            writeOut = 0;
-            tmpi = 1;
-            PCALL(tmpi, tmpi, &=, handleEvent, (PA, timestamp, tmTick, rtrack, event, &writeOut));
-            if (tmpi) {
-                Pm_WriteShort(hstate->odstream, 0, event->e.message);
-                if (writeOut) {
-                    MfEvent *newevent;
-                    newevent = Mf_NewEvent();
-                    newevent->absoluteTm = event->absoluteTm;
-                    newevent->e.message = event->e.message;
-                    Mf_StreamWriteOne(hstate->ofstream, rtrack, newevent);
-                }
+            for (i = 0; i < count; i++) {
+                if (play[i])
+                    play[i] = hdispatchEvents[d].single(hstate, p, timestamp, tmTick,
+                        rtracks[i], events[i], writeOut + i);
             }
 
         }
+        if (showStats) hookTimeAdd(&hdispatchEvents[d].time, histogramNow() - tm);
+    }
 
-        Mf_FreeEvent(event);
+    /* they're all at the same tick */
+    ts = outputLatency ? tickTimestamp(hstate, events[0]->absoluteTm) : timestamp;
+    for (i = 0; i < count; i++) {
+        if (!play[i]) continue;
+        writeDeviceAt(hstate, rtracks[i], events[i]->e.message, ts);
+        if (writeOut[i])
+            writeEvent(hstate, rtracks[i], events[i]->absoluteTm, events[i]->e.message);
     }
 
-    if (Mf_StreamEmpty(hstate->ifstream) == TRUE) {
-        MfFile *of;
-        FILE *ofh;
-        Mf_FreeFile(Mf_CloseStream(hstate->ifstream));
-        of = Mf_CloseStream(hstate->ofstream);
-        SF(ofh, fopen, NULL, (hstate->ofile, "wb"));
-        Mf_WriteMidiFile(ofh, of);
-        fclose(ofh);
-        Mf_FreeFile(of);
-        Pm_Terminate();
-        ready = 0;
-
-        /* quit somehow */
-        tmpi = 0;
-        PCALL(tmpi, !tmpi, |=, quit, (PA, 0));
-        if (!tmpi) exit(0);
+    chordCt = 0;
+}
+
+/* make room for a chord of this many events */
+void chordGrow(int max)
+{
+    SF(chordEvents, realloc, NULL, (chordEvents, max * sizeof(MfEvent *)));
+    SF(chordTracks, realloc, NULL, (chordTracks, max * sizeof(int)));
+    SF(chordPlay, realloc, NULL, (chordPlay, max * sizeof(int)));
+    SF(chordWriteOut, realloc, NULL, (chordWriteOut, max * sizeof(int)));
+    chordMax = max;
+}
+
+/* replay captured input as fast as we can, stepping time a millisecond at a
+ * time as the live timer would */
+void replay(struct HumidityState *hstate)
+{
+    while (ready) {
+        handler(replayNow, hstate);
+        if (!ready) break;
+
+        /* if we're out of input and waiting for input to continue, we'll never
+         * get anywhere */
+        if (replayCur >= replayCt &&
+                (hstate->nextTick <= 0 ||
+                 Mf_StreamNext(hstate->ifstream) >= (uint32_t) hstate->nextTick)) {
+            fprintf(stderr, "Replayed input ended before the input file.\n");
+            finish(hstate);
+            break;
+        }
+
+        replayNow++;
+    }
+    outputWriterJoin(&outputWriter);
+    exit(exitStatus);
+}
+
+/* with --sched event, call the handler only when there's something to do:
+ * input has arrived, the next event in the file is due, or it's been
+ * SCHED_MAX_SLEEP, so that plugins which poll something else still get their
+ * ticks */
+void *schedThread(void *vphstate)
+{
+    struct HumidityState *hstate = (struct HumidityState *) vphstate;
+    PtTimestamp now, wake, interval;
+
+    while (ready) {
+        now = Pt_Time();
+        handler(now, hstate);
+        if (!ready) break;
+
+        /* PortMidi gives us no descriptor to block on, so poll for input,
+         * which is far cheaper than a handler pass. Input is a performer's
+         * tap, so keep polling at full rate whenever there's a device to read;
+         * with none, there's nothing to poll for until the next event */
+        wake = now + schedDelay(hstate, now);
+        while ((now = Pt_Time()) < wake &&
+               !inputWaiting(hstate)) {
+            interval = hstate->idevCt ? SCHED_POLL_INTERVAL : wake - now;
+            Pt_Sleep((wake - now < interval) ? wake - now : interval);
+        }
+    }
+
+    return NULL;
+}
+
+/* how long can we sleep before the next event in the input file is due? */
+PtTimestamp schedDelay(struct HumidityState *hstate, PtTimestamp now)
+{
+    uint32_t curTick, next, tempo, timeDivision;
+    uint64_t delay;
+
+    /* nothing will happen until input arrives */
+    if (hstate->nextTick <= 0) return SCHED_MAX_SLEEP;
+
+    next = Mf_StreamNext(hstate->ifstream);
+    if (next >= (uint32_t) hstate->nextTick) return SCHED_MAX_SLEEP;
+
+    curTick = Mf_StreamGetTick(hstate->ifstream, now);
+    if (next <= curTick) return SCHED_POLL_INTERVAL;
+
+    /* ticks to ms, rounding up (tempo is in us per quarter note) */
+    tempo = Mf_StreamGetTempo(hstate->ifstream);
+    timeDivision = hstate->ifstream->file->timeDivision;
+    if (timeDivision == 0 || (timeDivision & 0x8000)) return SCHED_POLL_INTERVAL;
+    delay = ((uint64_t) (next - curTick) * tempo + timeDivision * 1000 - 1) / (timeDivision * 1000);
+
+    /* we can play it that much early */
+    delay = (delay > (uint64_t) outputLookahead) ? delay - outputLookahead : 0;
+
+    if (delay < SCHED_POLL_INTERVAL) return SCHED_POLL_INTERVAL;
+    if (delay > SCHED_MAX_SLEEP) return SCHED_MAX_SLEEP;
+    return (PtTimestamp) delay;
+}
+
+/* we've reached the end of the input. This is usually called from the timer
+ * callback, so just tell the output thread to finish up */
+void finish(struct HumidityState *hstate)
+{
+    ready = 0;
+    finishedInput = Mf_CloseStream(hstate->ifstream);
+    hstate->ifstream = NULL;
+
+    /* everything we've queued must be visible before we say we're closing */
+    __sync_synchronize();
+    outputClosing = 1;
+}
+
+/* write an output record through the CC filter, if any */
+void filterRecord(struct HumidityState *hstate, struct OutputRecord *rec)
+{
+    if (fileFilter && Pm_MessageStatus(rec->message) != MIDI_STATUS_META) {
+        /* anything held back which is due by now goes first */
+        struct OutputRecord due;
+        due.metaType = due.metaLength = 0;
+        while (ccFilterDue(fileFilter, rec->absoluteTm, 0, &due.track, &due.message, &due.absoluteTm))
+            writeRecord(hstate, &due);
+        if (!ccFilterPass(fileFilter, rec->track, rec->message, rec->absoluteTm))
+            return;
+    }
+    writeRecord(hstate, rec);
+}
+
+/* write queued output events into ofstream, then hand the output off to be
+ * written when we're done */
+void *outputThread(void *vphstate)
+{
+    struct HumidityState *hstate = (struct HumidityState *) vphstate;
+    struct OutputRecord rec;
+    int closing;
+
+    do {
+        closing = outputClosing;
+        while (ringBufferPop(outputRing, &rec))
+            filterRecord(hstate, &rec);
+        if (statsRequested) {
+            statsRequested = 0;
+            printStats();
+        }
+        if (!closing) Pt_Sleep(OUTPUT_DRAIN_INTERVAL);
+    } while (!closing);
+
+    if (outputDropped)
+        fprintf(stderr, "Warning: %u events were dropped from the output.\n", (unsigned) outputDropped);
+
+    /* and anything still held back */
+    if (fileFilter) {
+        rec.metaType = rec.metaLength = 0;
+        while (ccFilterDue(fileFilter, 0, 1, &rec.track, &rec.message, &rec.absoluteTm))
+            writeRecord(hstate, &rec);
+    }
+
+    if (lazyInput) {
+        lazyFileClose(lazyInput);
+        lazyInput = NULL;
+    }
+
+    outputWriterSubmit(&outputWriter, Mf_CloseStream(hstate->ofstream), finishedInput);
+    hstate->ofstream = NULL;
+    finishedInput = NULL;
+    return NULL;
+}
+
+/* write a queued record into ofstream */
+void writeRecord(struct HumidityState *hstate, struct OutputRecord *rec)
+{
+    MfEvent *event;
+
+    if (Pm_MessageStatus(rec->message) == MIDI_STATUS_META) {
+        event = eventPoolNewMetaEvent(eventPool, rec->metaLength);
+        event->meta->type = rec->metaType;
+        memcpy(event->meta->data, rec->metaData, rec->metaLength);
+    } else {
+        event = eventPoolNewEvent(eventPool);
+    }
+    event->absoluteTm = rec->absoluteTm;
+    event->e.message = rec->message;
+    Mf_StreamWriteOne(hstate->ofstream, rec->track, event);
+}
+
+/* called from the output writer once the output has been written, to clean up
+ * and quit */
+void finished(void *vphstate)
+{
+    int tmpi;
+    struct HumidityState *hstate = (struct HumidityState *) vphstate;
+
+    pthread_join(outputThreadId, NULL);
+    if (schedEvent && !replayFile) pthread_join(schedThreadId, NULL);
+    ringBufferFree(outputRing);
+    outputRing = NULL;
+    if (captureWriter) {
+        captureWriterClose(captureWriter);
+        captureWriter = NULL;
+    }
+    noteIndexFree(hstate->noteIndex, noteIndexCt);
+    hstate->noteIndex = NULL;
+    freeSpentEvents();
+
+    if (outputBatchDropped)
+        fprintf(stderr, "Warning: %u messages could not be written to the output device.\n",
+            (unsigned) outputBatchDropped);
+    if (showStats) printStats();
+    if (liveFilter) {
+        ccFilterFree(liveFilter);
+        ccFilterFree(fileFilter);
+        liveFilter = fileFilter = NULL;
+    }
+    eventPoolFree(eventPool);
+    eventPool = NULL;
+    free(chordEvents);
+    free(chordTracks);
+    free(chordPlay);
+    free(chordWriteOut);
+    chordEvents = NULL;
+    chordTracks = chordPlay = chordWriteOut = NULL;
+    chordMax = 0;
+    if (measureLatency) {
+        printLatency();
+        free(tapLatencies);
+        free(tapProcessing);
+        tapLatencies = NULL;
+        tapProcessing = NULL;
+    }
+
+    Pm_Terminate();
+
+    /* quit somehow (if nobody does, the main thread will) */
+    tmpi = 0;
+    PCALL(tmpi, !tmpi, |=, quit, (PA, exitStatus));
+}
+
+/* print our statistics to stderr. Call from anywhere but the timer thread */
+void printStats(void)
+{
+    fprintf(stderr, "Event pool: %lu/%lu events, %lu/%lu metas used, %lu+%lu from the heap\n",
+        (unsigned long) eventPool->eventsUsed, (unsigned long) eventPool->eventCt,
+        (unsigned long) eventPool->metasUsed, (unsigned long) eventPool->metaCt,
+        (unsigned long) eventPool->eventMisses, (unsigned long) eventPool->metaMisses);
+    fprintf(stderr, "Played events: %lu\n", (unsigned long) spentCt);
+    if (liveFilter)
+        fprintf(stderr, "Controller messages filtered: %u to devices, %u from the output file\n",
+            (unsigned) liveFilter->dropped, (unsigned) fileFilter->dropped);
+    histogramPrint(stderr, &statPreMidi, "ns");
+    histogramPrint(stderr, &statGetTick, "ns");
+    histogramPrint(stderr, &statWithMidi, "ns");
+    histogramPrint(stderr, &statReadLoop, "ns");
+    histogramPrint(stderr, &statWrite, "ns");
+    histogramPrint(stderr, &statJitter, "ns");
+    histogramPrint(stderr, &statEventsPerTick, "events");
+
+    fprintf(stderr, "Time in plugins:\n");
+    {
+        int i;
+#define PFUNC(type, nm, args) \
+        for (i = 0; i < hdispatch_ ## nm ## _ct; i++) \
+            printHookTime(#nm, hdispatch_ ## nm[i].pnum, &hdispatch_ ## nm[i].time);
+#include "hplugin_functions.h"
+#undef PFUNC
+        for (i = 0; i < hdispatchEventsCt; i++)
+            printHookTime(hdispatchEvents[i].batch ? "handleEvents (chords)" : "handleEvent (chords)",
+                hdispatchEvents[i].pnum, &hdispatchEvents[i].time);
+    }
+}
+
+/* account for a call to a plugin hook */
+void hookTimeAdd(struct HookTime *time, uint64_t ns)
+{
+    time->calls++;
+    time->total += ns;
+    if (ns > time->max) time->max = ns;
+}
+
+void printHookTime(const char *hook, int pnum, struct HookTime *time)
+{
+    if (!time->calls) return;
+    fprintf(stderr, "\t%s %s: %llu calls, mean %llu, max %llu ns\n",
+        hpluginNames[pnum], hook,
+        (unsigned long long) time->calls,
+        (unsigned long long) (time->total / time->calls),
+        (unsigned long long) time->max);
+}
+
+/* ask for statistics to be printed */
+void statsSignal(int sig)
+{
+    statsRequested = 1;
+}
+
+/* free events we've played */
+void freeSpentEvents(void)
+{
+    while (spentEvents) {
+        MfEvent *next = spentEvents->next;
+        Mf_FreeEvent(spentEvents);
+        spentEvents = next;
+    }
+}
+
+/* free the output file, which is full of pool events */
+void freeOutput(MfFile *file, void *vphstate)
+{
+    eventPoolFreeFile(eventPool, file);
+}
+
+/* read from the input batch for this tick */
+int readBatch(struct HumidityState *hstate, PmEvent *buffer, int32_t length)
+{
+    int32_t ct = 0;
+    while (ct < length && inputBatchCur < hstate->inputCt)
+        buffer[ct++] = hstate->input[inputBatchCur++];
+    return ct;
+}
+
+/* read input from the real input devices, merged by timestamp */
+int readDevice(struct HumidityState *hstate, PmEvent *buffer, int *sources, int32_t length)
+{
+    int32_t cts[HUMIDITY_MAX_INPUTS], curs[HUMIDITY_MAX_INPUTS];
+    int32_t ct = 0, per;
+    int d, next;
+
+    if (hstate->idevCt == 0) return 0;
+
+    /* each device gets its share of the buffer */
+    per = length / hstate->idevCt;
+    for (d = 0; d < hstate->idevCt; d++) {
+        cts[d] = Pm_Read(hstate->idstreams[d], deviceBatch[d], per);
+        if (cts[d] < 0) cts[d] = 0;
+        curs[d] = 0;
+    }
+
+    /* each device's events are already in order, so merge them */
+    while (1) {
+        next = -1;
+        for (d = 0; d < hstate->idevCt; d++) {
+            if (curs[d] < cts[d] &&
+                (next < 0 || deviceBatch[d][curs[d]].timestamp < deviceBatch[next][curs[next]].timestamp))
+                next = d;
+        }
+        if (next < 0) break;
+        buffer[ct] = deviceBatch[next][curs[next]++];
+        sources[ct] = next;
+        ct++;
+    }
+
+    if (ct > 0 && captureWriter) captureWriterAdd(captureWriter, buffer, sources, ct);
+    if (ct > 0 && measureLatency) addTaps(buffer, ct);
+    return ct;
+}
+
+/* is there input waiting on any input device? */
+int inputWaiting(struct HumidityState *hstate)
+{
+    int d;
+    for (d = 0; d < hstate->idevCt; d++) {
+        if (Pm_Poll(hstate->idstreams[d]) == TRUE) return 1;
+    }
+    return 0;
+}
+
+/* read input from the capture we're replaying, up to the current time */
+int readReplay(struct HumidityState *hstate, PmEvent *buffer, int *sources, int32_t length)
+{
+    int32_t ct = 0;
+    while (ct < length && replayCur < replayCt &&
+            replayEvents[replayCur].timestamp <= replayNow) {
+        sources[ct] = replaySources[replayCur];
+        buffer[ct++] = replayEvents[replayCur++];
+    }
+    if (measureLatency) addTaps(buffer, ct);
+    return ct;
+}
+
+/* write a message to the output device, if there is one, now */
+int writeDevice(struct HumidityState *hstate, PmMessage message)
+{
+    return writeDeviceAt(hstate, -1, message, curTimestamp);
+}
+
+/* write a message from the given track to its output device, now */
+int writeDeviceTrack(struct HumidityState *hstate, int track, PmMessage message)
+{
+    return writeDeviceAt(hstate, track, message, curTimestamp);
+}
+
+/* write a message from the given track (-1 for none) to its output device, to
+ * be played at the given time (plus the output latency) */
+int writeDeviceAt(struct HumidityState *hstate, int track, PmMessage message, PtTimestamp timestamp)
+{
+    int output;
+
+    /* does this answer a tap? */
+    if (tapReleased && Pm_MessageType(message) == MIDI_NOTE_ON &&
+            Pm_MessageData2(message) > 0) {
+        struct LatencyTap *tap = pendingTaps + pendingTapHead;
+        if (tapCt < LATENCY_MAX) {
+            tapLatencies[tapCt] = timestamp + outputLatency - tap->timestamp;
+            tapProcessing[tapCt] = histogramNow() - tap->readTm;
+            tapCt++;
+        }
+        pendingTapHead = (pendingTapHead + 1) % LATENCY_PENDING;
+        pendingTapCt--;
+        tapReleased = 0;
+    }
+
+    output = routeOutput(track, message);
+    if (!hstate->odstreams[output]) return 0;
+    if (liveFilter && !ccFilterPass(liveFilter, output, message, (uint32_t) timestamp))
+        return 1;
+    queueOutput(hstate, output, message, timestamp);
+    return 1;
+}
+
+/* add a message to an output device's queue */
+void queueOutput(struct HumidityState *hstate, int output, PmMessage message, PtTimestamp timestamp)
+{
+    struct OutputQueue *queue = outputQueues + output;
+    if (queue->ct >= OUTPUT_BATCH) flushQueue(hstate, output);
+    queue->events[queue->ct].message = message;
+    queue->events[queue->ct].timestamp = timestamp;
+    queue->ct++;
+}
+
+/* when in the timer's time does this tick of the input file fall? */
+PtTimestamp tickTimestamp(struct HumidityState *hstate, uint32_t tick)
+{
+    uint32_t timeDivision = hstate->ifstream->file->timeDivision;
+    int64_t ticks = (int64_t) tick - anchorTick;
+
+    if (timeDivision == 0 || (timeDivision & 0x8000)) return anchorTs;
+    return anchorTs + ticks * Mf_StreamGetTempo(hstate->ifstream) / ((int64_t) timeDivision * 1000);
+}
+
+/* write out everything collected by writeDevice */
+void flushOutput(struct HumidityState *hstate)
+{
+    int o;
+    PmMessage message;
+    uint32_t due;
+
+    /* send any controller changes which were held back and are now due */
+    if (liveFilter) {
+        while (ccFilterDue(liveFilter, (uint32_t) curTimestamp, 0, &o, &message, &due))
+            if (hstate->odstreams[o])
+                queueOutput(hstate, o, message, (PtTimestamp) due);
+    }
+
+    for (o = 0; o < hstate->odevCt; o++)
+        flushQueue(hstate, o);
+}
+
+/* write out everything collected for one output device */
+void flushQueue(struct HumidityState *hstate, int output)
+{
+    struct OutputQueue *queue = outputQueues + output;
+    PmEvent *events = queue->events;
+    int32_t i, j;
+
+    if (queue->ct && hstate->odstreams[output]) {
+        if (outputLatency) {
+            /* timestamps must be in order, and never go backwards; a (stable)
+             * insertion sort is fine for a tick's worth */
+            for (i = 1; i < queue->ct; i++) {
+                PmEvent ev = events[i];
+                for (j = i; j > 0 && events[j-1].timestamp > ev.timestamp; j--)
+                    events[j] = events[j-1];
+                events[j] = ev;
+            }
+            for (i = 0; i < queue->ct; i++) {
+                if (events[i].timestamp < queue->lastTs)
+                    events[i].timestamp = queue->lastTs;
+                queue->lastTs = events[i].timestamp;
+            }
+        }
+
+        if (Pm_Write(hstate->odstreams[output], events, queue->ct) != pmNoError)
+            outputBatchDropped += queue->ct;
+    }
+    queue->ct = 0;
+}
+
+/* parse a --route argument, <track>:<channel>=<output> */
+void parseRoute(struct HumidityState *hstate, char *route)
+{
+    struct OutputRoute *r;
+    char *channel, *output;
+
+    channel = strchr(route, ':');
+    output = strchr(route, '=');
+    if (!channel || !output || output < channel || routeCt >= MAX_ROUTES) {
+        usage(hstate);
+        exit(1);
+    }
+    channel++;
+    output++;
+
+    r = routes + routeCt++;
+    r->track = (route[0] == '*') ? -1 : atoi(route);
+    r->channel = (channel[0] == '*') ? -1 : atoi(channel) - 1;
+    r->output = atoi(output);
+    if (r->channel < -1 || r->channel > 15 || r->output < 0) {
+        usage(hstate);
+        exit(1);
+    }
+}
+
+/* build the routing table from the routes */
+void buildRoutes(int trackCt)
+{
+    int row, ch, i;
+
+    routeTracks = trackCt;
+    SF(routeTable, calloc, NULL, ((trackCt + 1) * 16, 1));
+    for (row = 0; row <= trackCt; row++) {
+        for (ch = 0; ch < 16; ch++) {
+            for (i = 0; i < routeCt; i++) {
+                struct OutputRoute *r = routes + i;
+                if ((r->track == -1 || r->track == row - 1) &&
+                    (r->channel == -1 || r->channel == ch))
+                    routeTable[row*16+ch] = r->output;
+            }
+        }
+    }
+}
+
+/* which output does this message from this track go to? */
+int routeOutput(int track, PmMessage message)
+{
+    uint8_t status = Pm_MessageStatus(message);
+
+    /* system messages aren't on a channel */
+    if (status >= 0xF0) return 0;
+
+    if (track < 0 || track >= routeTracks) track = -1;
+    return routeTable[(track + 1) * 16 + (status & 0xF)];
+}
+
+/* remember any taps among these input events, to measure their latency */
+void addTaps(PmEvent *events, int32_t ct)
+{
+    int32_t i;
+    uint64_t now = histogramNow();
+
+    batchSerial = inputSerial;
+    inputSerial += ct;
+
+    for (i = 0; i < ct; i++) {
+        uint8_t type = Pm_MessageType(events[i].message);
+        struct LatencyTap *tap;
+        if ((type != MIDI_NOTE_ON && type != MIDI_CONTROLLER) ||
+                Pm_MessageData2(events[i].message) == 0)
+            continue;
+
+        /* the oldest taps are the least likely to be answered */
+        if (pendingTapCt >= LATENCY_PENDING) {
+            tapReleased = 0;
+            pendingTapHead = (pendingTapHead + 1) % LATENCY_PENDING;
+            pendingTapCt--;
+            tapsMissed++;
+        }
+        tap = pendingTaps + (pendingTapHead + pendingTapCt) % LATENCY_PENDING;
+        tap->serial = batchSerial + i;
+        tap->timestamp = events[i].timestamp;
+        tap->readTm = now;
+        pendingTapCt++;
+    }
+}
+
+/* a plugin has said which of this tick's input events released its notes, so
+ * if it's a tap, the next note-on answers it, and older taps never will be */
+void releaseTap(struct HumidityState *hstate)
+{
+    uint32_t serial;
+
+    if (hstate->released < 0 || hstate->released >= hstate->inputCt) return;
+    serial = batchSerial + hstate->released;
+
+    tapReleased = 0;
+    while (pendingTapCt && pendingTaps[pendingTapHead].serial != serial) {
+        pendingTapHead = (pendingTapHead + 1) % LATENCY_PENDING;
+        pendingTapCt--;
+        tapsMissed++;
+    }
+    if (pendingTapCt) tapReleased = 1;
+}
+
+static int cmpTimestamp(const void *l, const void *r)
+{
+    PtTimestamp a = *(const PtTimestamp *) l, b = *(const PtTimestamp *) r;
+    return (a > b) - (a < b);
+}
+
+static int cmpU64(const void *l, const void *r)
+{
+    uint64_t a = *(const uint64_t *) l, b = *(const uint64_t *) r;
+    return (a > b) - (a < b);
+}
+
+/* print the tap-to-output latencies, and check them against the limit */
+void printLatency(void)
+{
+    int32_t p50, p99;
+
+    tapsMissed += pendingTapCt;
+    if (tapCt == 0) {
+        fprintf(stderr, "Latency: no taps were answered (%u unanswered)\n", (unsigned) tapsMissed);
+        if (latencyLimit >= 0 || processingLimit >= 0) exitStatus = 1;
+        return;
+    }
+
+    qsort(tapLatencies, tapCt, sizeof(PtTimestamp), cmpTimestamp);
+    qsort(tapProcessing, tapCt, sizeof(uint64_t), cmpU64);
+    p50 = (tapCt - 1) / 2;
+    p99 = (tapCt - 1) * 99 / 100;
+
+    fprintf(stderr, "Latency: %ld taps answered, %u unanswered\n"
+                    "\ttap to output: p50 %ld ms, p99 %ld ms, max %ld ms\n"
+                    "\tprocessing: p50 %llu ns, p99 %llu ns, max %llu ns\n",
+        (long) tapCt, (unsigned) tapsMissed,
+        (long) tapLatencies[p50], (long) tapLatencies[p99], (long) tapLatencies[tapCt-1],
+        (unsigned long long) tapProcessing[p50], (unsigned long long) tapProcessing[p99],
+        (unsigned long long) tapProcessing[tapCt-1]);
+
+    if (latencyLimit >= 0 && tapLatencies[p99] > latencyLimit) {
+        fprintf(stderr, "Latency limit of %ld ms exceeded!\n", (long) latencyLimit);
+        exitStatus = 1;
+    }
+    if (processingLimit >= 0 && tapProcessing[p99] > (uint64_t) processingLimit * 1000) {
+        fprintf(stderr, "Processing limit of %ld us exceeded!\n", (long) processingLimit);
+        exitStatus = 1;
+    }
+}
+
+/* queue a record for the output thread. Live, the timer thread can't wait, so
+ * if there's no room it's dropped; when replaying there's no timer to keep
+ * up with, so wait for the output thread to make room instead */
+int pushRecord(struct OutputRecord *rec)
+{
+    while (!ringBufferPush(outputRing, rec)) {
+        if (!replayFile || outputClosing) {
+            outputDropped++;
+            return 0;
+        }
+        Pt_Sleep(1);
+    }
+    return 1;
+}
+
+/* queue an event to be written to the output file */
+int writeEvent(struct HumidityState *hstate, int track, uint32_t absoluteTm, PmMessage message)
+{
+    struct OutputRecord rec;
+    rec.track = track;
+    rec.absoluteTm = absoluteTm;
+    rec.message = message;
+    rec.metaType = rec.metaLength = 0;
+    if (!outputRing) {
+        /* the output thread isn't running yet (plugin begin), so ofstream is still ours */
+        filterRecord(hstate, &rec);
+        return 1;
+    }
+    return pushRecord(&rec);
+}
+
+/* queue a (short) meta event to be written to the output file */
+int writeMeta(struct HumidityState *hstate, int track, uint32_t absoluteTm,
+    uint8_t type, uint8_t length, const unsigned char *data)
+{
+    struct OutputRecord rec;
+    if (length > OUTPUT_META_MAX) {
+        outputDropped++;
+        return 0;
+    }
+    rec.track = track;
+    rec.absoluteTm = absoluteTm;
+    rec.message = Pm_Message(MIDI_STATUS_META, 0, 0);
+    rec.metaType = type;
+    rec.metaLength = length;
+    memcpy(rec.metaData, data, length);
+    if (!outputRing) {
+        /* the output thread isn't running yet (plugin begin), so ofstream is still ours */
+        filterRecord(hstate, &rec);
+        return 1;
     }
+    return pushRecord(&rec);
 }
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "midifile/midi.h"
+#include "midiload.h"
+#include "smf.h"
+
+/* how far ahead of what's been asked for to decode lazily, in beats */
+#define LAZY_AHEAD_BEATS 4
+
+/* when it's caught up, the decoding thread indexes notes this many decoding
+ * chunks at a time, so the index is soon well ahead of the decoding */
+#define LAZY_INDEX_CHUNKS 16
+
+/* decoded events and played lists the rings can hold, and how long the
+ * decoding thread sleeps when there's nothing to do */
+#define LAZY_EVENT_RING 65536
+#define LAZY_SPENT_RING 4096
+#define LAZY_POLL_INTERVAL 2 /* ms */
+
+/* the work shared by the loader threads. Tracks are handed out in order */
+struct LoadWork {
+    pthread_mutex_t lock;
+    struct SmfFile *smf;
+    MfFile *file;
+    int next;
+    int failed;
+};
+
+/* read the next event of a track as an MfEvent. Returns NULL at the end of
+ * the track, or if it's corrupt (setting *corrupt) */
+static MfEvent *readEvent(struct SmfTrackReader *reader, uint32_t lastTick, int *corrupt)
+{
+    struct SmfEvent sevent;
+    MfEvent *event;
+    int rd;
+
+    *corrupt = 0;
+    rd = smfTrackRead(reader, &sevent);
+    if (rd < 0) {
+        *corrupt = 1;
+        return NULL;
+    }
+    if (rd == 0) {
+        /* Mf_ReadMidiFile keeps the end-of-track event, so we do too (but
+         * only once) */
+        if (!reader->endOfTrack) return NULL;
+        reader->endOfTrack = 0;
+        sevent.tick = reader->tick;
+        sevent.status = SMF_STATUS_META;
+        sevent.metaType = SMF_META_END_OF_TRACK;
+        sevent.length = 0;
+    }
+
+    event = Mf_NewEvent();
+    event->deltaTm = sevent.tick - lastTick;
+    event->absoluteTm = sevent.tick;
+
+    if (sevent.status == SMF_STATUS_META ||
+        sevent.status == SMF_STATUS_SYSEX ||
+        sevent.status == SMF_STATUS_SYSEX_ESCAPE) {
+        event->e.message = Pm_Message(sevent.status, 0, 0);
+        event->meta = Mf_NewMeta(sevent.length);
+        event->meta->type = (sevent.status == SMF_STATUS_META) ? sevent.metaType : 0;
+        if (sevent.length) memcpy(event->meta->data, sevent.bytes, sevent.length);
+    } else {
+        event->e.message = Pm_Message(sevent.status, sevent.data[0], sevent.data[1]);
+    }
+
+    return event;
+}
+
+/* add an event to the end of a track */
+static void appendEvent(MfTrack *track, MfEvent *event)
+{
+    if (track->tail) track->tail->next = event;
+    else track->head = event;
+    track->tail = event;
+}
+
+/* decode one track into its MfTrack. Returns 0 if it's corrupt */
+static int loadTrack(struct SmfFile *smf, int ti, MfTrack *track)
+{
+    struct SmfTrackReader *reader;
+    MfEvent *event;
+    uint32_t lastTick = 0;
+    int corrupt;
+
+    reader = smfTrackOpen(smf, ti);
+    while ((event = readEvent(reader, lastTick, &corrupt))) {
+        lastTick = event->absoluteTm;
+        appendEvent(track, event);
+    }
+    smfTrackClose(reader);
+
+    return !corrupt;
+}
+
+static void *loadThread(void *vpwork)
+{
+    struct LoadWork *work = (struct LoadWork *) vpwork;
+    int ti;
+
+    while (1) {
+        pthread_mutex_lock(&work->lock);
+        ti = work->next++;
+        pthread_mutex_unlock(&work->lock);
+        if (ti >= work->smf->trackCt) break;
+
+        if (!loadTrack(work->smf, ti, work->file->tracks[ti])) {
+            pthread_mutex_lock(&work->lock);
+            work->failed = 1;
+            pthread_mutex_unlock(&work->lock);
+        }
+    }
+
+    return NULL;
+}
+
+MfFile *loadMidiFile(const char *filename, int threads)
+{
+    struct LoadWork work;
+    pthread_t *pthreads;
+    int i, tmpi;
+
+    memset(&work, 0, sizeof(work));
+    if (!(work.smf = smfOpen(filename))) return NULL;
+
+    /* make all the tracks first, so the threads needn't touch the file */
+    work.file = Mf_NewFile(work.smf->timeDivision);
+    work.file->format = work.smf->format;
+    while (work.file->trackCt < work.smf->trackCt)
+        Mf_NewTrack(work.file);
+
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > work.smf->trackCt) threads = work.smf->trackCt;
+    if (threads < 1) threads = 1;
+
+    /* then decode them */
+    pthread_mutex_init(&work.lock, NULL);
+    SF(pthreads, malloc, NULL, (threads * sizeof(pthread_t)));
+    for (i = 1; i < threads; i++) {
+        tmpi = pthread_create(&pthreads[i], NULL, loadThread, &work);
+        if (tmpi != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(tmpi));
+            exit(1);
+        }
+    }
+    loadThread(&work);
+    for (i = 1; i < threads; i++)
+        pthread_join(pthreads[i], NULL);
+    free(pthreads);
+    pthread_mutex_destroy(&work.lock);
+    smfClose(work.smf);
+
+    if (work.failed) {
+        fprintf(stderr, "%s is corrupt.\n", filename);
+        Mf_FreeFile(work.file);
+        return NULL;
+    }
+
+    return work.file;
+}
+
+/* a decoded event for the reader, or (with no event) the new horizon */
+struct LazyRecord {
+    MfEvent *event;
+    int track;
+    uint32_t tick;
+};
+
+/* tick + by, without wrapping */
+static uint32_t ticksAfter(uint32_t tick, uint32_t by)
+{
+    return (tick + by < tick) ? (uint32_t) -1 : tick + by;
+}
+
+static void freeEvents(MfEvent *events)
+{
+    MfEvent *next;
+    for (; events; events = next) {
+        next = events->next;
+        Mf_FreeEvent(events);
+    }
+}
+
+/* hand a record to the reader, waiting for room. Returns 0 if we're closing */
+static int lazyPush(struct LazyFile *lazy, struct LazyRecord *rec)
+{
+    MfEvent *spent;
+    while (!ringBufferPush(lazy->events, rec)) {
+        if (lazy->closing) return 0;
+
+        /* free what's been played while we wait */
+        while (ringBufferPop(lazy->spent, &spent))
+            freeEvents(spent);
+        usleep(LAZY_POLL_INTERVAL * 1000);
+    }
+    return 1;
+}
+
+/* decode every unfinished track up to and including the first event after
+ * the target, and index its notes at least as far. Before the decoding thread
+ * starts, events go straight into the file; after, through the ring, followed
+ * by the new horizon. Returns 0 if we're closing */
+static int lazyDecodeTo(struct LazyFile *lazy, uint32_t target, int direct)
+{
+    struct LazyRecord rec;
+    MfEvent *event;
+    int ti, corrupt, unfinished = 0;
+
+    for (ti = 0; ti < lazy->file->trackCt; ti++) {
+        struct SmfTrackReader *reader = lazy->readers[ti];
+        if (!reader) continue;
+
+        while (lazy->lastTicks[ti] <= target) {
+            event = readEvent(reader, lazy->lastTicks[ti], &corrupt);
+            if (!event) {
+                if (corrupt)
+                    fprintf(stderr, "Warning: track %d of %s is corrupt, and was cut short.\n",
+                        ti, lazy->smf->filename);
+                smfTrackClose(reader);
+                lazy->readers[ti] = reader = NULL;
+                break;
+            }
+            lazy->lastTicks[ti] = event->absoluteTm;
+            lazy->decoded++;
+
+            if (direct) {
+                appendEvent(lazy->file->tracks[ti], event);
+            } else {
+                rec.event = event;
+                rec.track = ti;
+                if (!lazyPush(lazy, &rec)) {
+                    Mf_FreeEvent(event);
+                    return 0;
+                }
+            }
+        }
+        if (reader) unfinished = 1;
+    }
+
+    /* once every track is done, there's nothing left to wait for */
+    if (!unfinished) target = (uint32_t) -1;
+    noteIndexBuilderExtend(lazy->notes, target);
+    lazy->decodedTo = target;
+
+    if (direct) {
+        lazy->horizon = target;
+        return 1;
+    }
+    rec.event = NULL;
+    rec.track = -1;
+    rec.tick = target;
+    return lazyPush(lazy, &rec);
+}
+
+/* decode ahead of the reader, free what it's played, and index notes when
+ * there's nothing else to do */
+static void *lazyThread(void *vplazy)
+{
+    struct LazyFile *lazy = (struct LazyFile *) vplazy;
+    MfEvent *spent;
+
+    while (!lazy->closing) {
+        while (ringBufferPop(lazy->spent, &spent))
+            freeEvents(spent);
+
+        if (lazy->decodedTo < ticksAfter(lazy->wanted, lazy->ahead)) {
+            if (!lazyDecodeTo(lazy, ticksAfter(lazy->wanted, 2 * lazy->ahead), 0)) break;
+
+        } else if (!lazy->notes->done) {
+            noteIndexBuilderExtend(lazy->notes,
+                ticksAfter(lazy->notes->horizon, LAZY_INDEX_CHUNKS * lazy->ahead));
+
+        } else {
+            usleep(LAZY_POLL_INTERVAL * 1000);
+
+        }
+    }
+
+    return NULL;
+}
+
+struct LazyFile *lazyFileOpen(const char *filename)
+{
+    struct LazyFile *lazy;
+    int ti, tmpi;
+
+    SF(lazy, calloc, NULL, (1, sizeof(struct LazyFile)));
+    if (!(lazy->smf = smfOpen(filename))) {
+        free(lazy);
+        return NULL;
+    }
+
+    lazy->file = Mf_NewFile(lazy->smf->timeDivision);
+    lazy->file->format = lazy->smf->format;
+    while (lazy->file->trackCt < lazy->smf->trackCt)
+        Mf_NewTrack(lazy->file);
+    lazy->notes = noteIndexBuilderNew(lazy->smf);
+
+    SF(lazy->readers, malloc, NULL, ((lazy->smf->trackCt + 1) * sizeof(struct SmfTrackReader *)));
+    SF(lazy->lastTicks, calloc, NULL, (lazy->smf->trackCt + 1, sizeof(uint32_t)));
+    for (ti = 0; ti < lazy->smf->trackCt; ti++)
+        lazy->readers[ti] = smfTrackOpen(lazy->smf, ti);
+
+    /* decode a few beats (or, for SMPTE time, a second) at a time */
+    if (lazy->smf->timeDivision & 0x8000)
+        lazy->ahead = (uint32_t) -(int8_t) (lazy->smf->timeDivision >> 8) *
+                      (lazy->smf->timeDivision & 0xFF);
+    else
+        lazy->ahead = LAZY_AHEAD_BEATS * lazy->smf->timeDivision;
+    if (lazy->ahead == 0) lazy->ahead = 1;
+
+    /* the start is decoded here, the rest as it's needed */
+    lazyDecodeTo(lazy, lazy->ahead, 1);
+    lazy->events = ringBufferNew(sizeof(struct LazyRecord), LAZY_EVENT_RING);
+    lazy->spent = ringBufferNew(sizeof(MfEvent *), LAZY_SPENT_RING);
+    tmpi = pthread_create(&lazy->thread, NULL, lazyThread, lazy);
+    if (tmpi != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(tmpi));
+        exit(1);
+    }
+
+    return lazy;
+}
+
+uint32_t lazyFileTake(struct LazyFile *lazy, uint32_t tick)
+{
+    struct LazyRecord rec;
+
+    if (tick > lazy->wanted) lazy->wanted = tick;
+    while (ringBufferPop(lazy->events, &rec)) {
+        if (rec.event)
+            appendEvent(lazy->file->tracks[rec.track], rec.event);
+        else
+            lazy->horizon = rec.tick;
+    }
+
+    return lazy->horizon;
+}
+
+int lazyFileRecycle(struct LazyFile *lazy, MfEvent *events)
+{
+    return ringBufferPush(lazy->spent, &events);
+}
+
+void lazyFileClose(struct LazyFile *lazy)
+{
+    struct LazyRecord rec;
+    MfEvent *spent;
+    int ti;
+
+    lazy->closing = 1;
+    pthread_join(lazy->thread, NULL);
+
+    /* anything decoded but never taken, or played but never freed */
+    while (ringBufferPop(lazy->events, &rec))
+        if (rec.event) Mf_FreeEvent(rec.event);
+    while (ringBufferPop(lazy->spent, &spent))
+        freeEvents(spent);
+    ringBufferFree(lazy->events);
+    ringBufferFree(lazy->spent);
+
+    for (ti = 0; ti < lazy->smf->trackCt; ti++)
+        if (lazy->readers[ti]) smfTrackClose(lazy->readers[ti]);
+    free(lazy->readers);
+    free(lazy->lastTicks);
+    noteIndexBuilderFree(lazy->notes);
+    smfClose(lazy->smf);
+    free(lazy);
+}
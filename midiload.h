@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MIDILOAD_H
+#define MIDILOAD_H
+
+#include <pthread.h>
+
+#include "midifile/midifile.h"
+#include "noteindex.h"
+#include "ringbuffer.h"
+#include "smf.h"
+
+/* load a MIDI file into the same MfFile that Mf_ReadMidiFile would produce,
+ * but decoding each track on a thread of its own. threads is the most threads
+ * to use, or 0 for one per CPU. Returns NULL (with a message) if the file
+ * isn't valid */
+MfFile *loadMidiFile(const char *filename, int threads);
+
+/* a MIDI file whose tracks are decoded only as they're needed, a little ahead
+ * of whatever's reading them, by a thread of its own. Decoded events are
+ * handed over to the reader's thread (through a ring, so the reader never
+ * blocks or touches the heap), and the reader hands back events it's done with
+ * to be freed. Every unfinished track always has at least one event after the
+ * horizon, so a stream over the file which reads no further sees the right
+ * next event */
+struct LazyFile {
+    struct SmfFile *smf;
+    MfFile *file;
+
+    /* the note-ons of each track, indexed ahead of the decoding */
+    struct NoteIndexBuilder *notes;
+
+    /* the decoding thread's: the reader for each track (NULL once it's fully
+     * decoded), the tick of the last event decoded in each, and how far
+     * every unfinished track has been decoded */
+    struct SmfTrackReader **readers;
+    uint32_t *lastTicks;
+    uint32_t decodedTo;
+
+    /* the reader's: every unfinished track in file has an event past this
+     * tick */
+    uint32_t horizon;
+
+    /* how many ticks past what's asked for to decode, so decoding happens in
+     * chunks rather than every time */
+    uint32_t ahead;
+
+    /* events decoded so far */
+    size_t decoded;
+
+    /* the decoding thread, the tick the reader last asked for, and the rings
+     * of decoded events (struct LazyRecord) and played events (lists, linked
+     * by next) */
+    pthread_t thread;
+    volatile uint32_t wanted;
+    volatile int closing;
+    struct RingBuffer *events, *spent;
+};
+
+/* open a file for lazy decoding. file is an MfFile with only its first
+ * events. Returns NULL (with a message) if the file isn't valid */
+struct LazyFile *lazyFileOpen(const char *filename);
+
+/* ask for every track to be decoded past tick, and take whatever's been
+ * decoded into file. Never blocks or allocates, so it's safe from the timer
+ * thread. Returns the horizon, which is short of tick if decoding has fallen
+ * behind */
+uint32_t lazyFileTake(struct LazyFile *lazy, uint32_t tick);
+
+/* hand back a list of events (linked by next) which have been played, to be
+ * freed by the decoding thread. Returns 0 if they can't be taken right now */
+int lazyFileRecycle(struct LazyFile *lazy, MfEvent *events);
+
+/* stop decoding, freeing anything not yet taken or freed. Doesn't free file
+ * or the note indices, which by now belong to whoever's using them */
+void lazyFileClose(struct LazyFile *lazy);
+
+#endif
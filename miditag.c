@@ -23,6 +23,7 @@
 #define _POSIX_C_SOURCE 200112L /* for vsnprintf */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "helpers.h"
@@ -81,11 +82,28 @@ int midiTagStream(MfStream *stream, const char *format, ...)
  * pre- and post- version) */
 int midiTagStreamHeader(MfStream *stream, const char *pre, const char *post)
 {
-    return midiTagStream(stream, "Humidity %s%s%s", pre?pre:"", humidityVersion, post?post:"");
+    char *text = midiTagHeaderText(pre, post);
+    int ret = midiTagStream(stream, "%s", text);
+    free(text);
+    return ret;
 }
 
 /* tag a MIDI stream with our generic footer */
 int midiTagStreamFooter(MfStream *stream)
 {
-    return midiTagStream(stream, "-- http://bitbucket.org/GregorR/humidity --");
+    return midiTagStream(stream, "%s", MIDI_TAG_FOOTER);
+}
+
+char *midiTagHeaderText(const char *pre, const char *post)
+{
+    char *buf;
+    size_t len;
+
+    if (!pre) pre = "";
+    if (!post) post = "";
+    len = strlen("Humidity ") + strlen(pre) + strlen(humidityVersion) + strlen(post) + 1;
+    SF(buf, malloc, NULL, (len));
+    sprintf(buf, "Humidity %s%s%s", pre, humidityVersion, post);
+
+    return buf;
 }
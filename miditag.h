@@ -37,4 +37,11 @@ int midiTagStreamHeader(MfStream *stream, const char *pre, const char *post);
 /* tag a MIDI stream with our generic footer */
 int midiTagStreamFooter(MfStream *stream);
 
+/* the text of our generic header, for writers which don't use streams. Must
+ * be freed */
+char *midiTagHeaderText(const char *pre, const char *post);
+
+/* the text of our generic footer */
+#define MIDI_TAG_FOOTER "-- http://bitbucket.org/GregorR/humidity --"
+
 #endif
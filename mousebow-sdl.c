@@ -136,7 +136,7 @@ int usage(HS)
 int begin(HS)
 {
     STATE;
-    int tmpi, i;
+    int tmpi;
 
     /* if we didn't get a track, complain */
     if (pstate->track < 0) {
@@ -147,16 +147,11 @@ int begin(HS)
     /* tag it */
     midiTagStream(hstate->ofstream, "[mousebow] track=%d", pstate->track);
 
-    /* set the expression of each channel; FIXME: always writes it into the 0
-     * track of the file, which will be redundant with multiple runs of
-     * mousebow */
-    for (i = 0; i < 16; i++) {
-        MfEvent *event;
-        PmMessage msg;
-        event = Mf_NewEvent();
-        msg = event->e.message = Pm_Message(Pm_MessageStatusGen(MIDI_CONTROLLER, i), 11 /* expression */, 64);
-        Pm_WriteShort(hstate->odstream, 0, msg);
-        Mf_StreamWriteOne(hstate->ofstream, 0, event);
+    /* set the expression of our track */
+    {
+        PmMessage msg = Pm_Message(Pm_MessageStatusGen(MIDI_CONTROLLER, pstate->track - 1), 11 /* expression */, 64);
+        hstate->writeOutputTrack(hstate, pstate->track, msg);
+        hstate->writeEvent(hstate, pstate->track, 0, msg);
     }
 
     /* set up SDL ... */
@@ -284,15 +279,10 @@ int mainLoop(HS)
 int findNextTick(HS, uint32_t atleast)
 {
     STATE;
-    MfTrack *mtrack = hstate->ifstream->file->tracks[pstate->track];
-    MfEvent *cur;
-    for (cur = mtrack->head; cur; cur = cur->next) {
-        if (cur->absoluteTm >= atleast &&
-            Pm_MessageType(cur->e.message) == MIDI_NOTE_ON &&
-            Pm_MessageData2(cur->e.message) > 0) {
-            hstate->nextTick = cur->absoluteTm;
-            return 1;
-        }
+    struct NoteIndexEntry *note = noteIndexNext(hstate->noteIndex + pstate->track, atleast);
+    if (note) {
+        hstate->nextTick = note->absoluteTm;
+        return 1;
     }
 
     /* didn't find one, set it huge */
@@ -362,7 +352,7 @@ int tickPreMidi(HS, PtTimestamp timestamp)
 int tickWithMidi(HS, PtTimestamp timestamp, uint32_t tmTick)
 {
     STATE;
-    MfEvent *event;
+    PmMessage msg;
 
     if (tmTick > pstate->lastExpressionMod) {
         int vol = ((double) pstate->velocity) / ((double) pstate->lastVelocity) * 64;
@@ -374,37 +364,38 @@ int tickWithMidi(HS, PtTimestamp timestamp, uint32_t tmTick)
             else vol = pstate->lastExpressionModVal - 1;
         }
         pstate->lastExpressionModVal = vol;
-        event = Mf_NewEvent();
-        event->absoluteTm = tmTick;
-        event->e.message = Pm_Message(Pm_MessageStatusGen(MIDI_CONTROLLER, pstate->track - 1), 11 /* expression */, vol);
-        Mf_StreamWriteOne(hstate->ofstream, pstate->track, event);
-        Pm_WriteShort(hstate->odstream, 0, event->e.message);
+        msg = Pm_Message(Pm_MessageStatusGen(MIDI_CONTROLLER, pstate->track - 1), 11 /* expression */, vol);
+        hstate->writeEvent(hstate, pstate->track, tmTick, msg);
+        hstate->writeOutputTrack(hstate, pstate->track, msg);
         pstate->lastExpressionMod = tmTick;
     }
 
     return 1;
 }
 
-int handleEvent(HS, PtTimestamp timestamp, uint32_t tmTick, int rtrack, MfEvent *event, int *writeOut)
+int handleEvents(HS, PtTimestamp timestamp, uint32_t tmTick, int count, MfEvent **events,
+    int *rtracks, int *play, int *writeOut)
 {
     STATE;
-    PmEvent ev = event->e;
-    if (Pm_MessageType(ev.message) == MIDI_NOTE_ON) {
-        if (Pm_MessageData2(ev.message) != 0 && pstate->track == rtrack) {
+    int i;
+    int32_t velocity = pstate->lastVelocity;
+    if (velocity < 0) velocity = 0;
+    if (velocity > 127) velocity = 127;
+
+    for (i = 0; i < count; i++) {
+        PmMessage msg = events[i]->e.message;
+        if (!play[i] || rtracks[i] != pstate->track) continue;
+        if (Pm_MessageType(msg) == MIDI_NOTE_ON && Pm_MessageData2(msg) != 0) {
             /* change the velocity */
-            int32_t velocity = pstate->lastVelocity;
-            if (velocity < 0) velocity = 0;
-            if (velocity > 127) velocity = 127;
-            ev.message = Pm_Message(
-                    Pm_MessageStatus(ev.message),
-                    Pm_MessageData1(ev.message),
+            events[i]->e.message = Pm_Message(
+                    Pm_MessageStatus(msg),
+                    Pm_MessageData1(msg),
                     velocity);
 
             /* and write it to our output */
-            *writeOut = 1;
+            writeOut[i] = 1;
         }
     }
-    event->e = ev;
 
     return 1;
 }
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "midifile/midi.h"
+#include "noteindex.h"
+
+struct NoteIndex *noteIndexBuild(MfFile *file)
+{
+    struct NoteIndex *indices;
+    int ti;
+
+    SF(indices, calloc, NULL, (file->trackCt ? file->trackCt : 1, sizeof(struct NoteIndex)));
+
+    for (ti = 0; ti < file->trackCt; ti++) {
+        struct NoteIndex *index = indices + ti;
+        MfEvent *cur;
+        int32_t ct = 0;
+
+        /* count the notes first, so we only allocate once */
+        for (cur = file->tracks[ti]->head; cur; cur = cur->next) {
+            if (!cur->meta &&
+                Pm_MessageType(cur->e.message) == MIDI_NOTE_ON &&
+                Pm_MessageData2(cur->e.message) > 0)
+                ct++;
+        }
+        if (ct == 0) continue;
+
+        SF(index->notes, malloc, NULL, (ct * sizeof(struct NoteIndexEntry)));
+
+        /* tracks are already in time order, so this is sorted */
+        for (cur = file->tracks[ti]->head; cur; cur = cur->next) {
+            if (!cur->meta &&
+                Pm_MessageType(cur->e.message) == MIDI_NOTE_ON &&
+                Pm_MessageData2(cur->e.message) > 0) {
+                index->notes[index->count].absoluteTm = cur->absoluteTm;
+                index->notes[index->count].velocity = Pm_MessageData2(cur->e.message);
+                index->count++;
+            }
+        }
+    }
+
+    return indices;
+}
+
+struct NoteIndexBuilder *noteIndexBuilderNew(struct SmfFile *file)
+{
+    struct NoteIndexBuilder *builder;
+    int ti;
+
+    SF(builder, calloc, NULL, (1, sizeof(struct NoteIndexBuilder)));
+    builder->file = file;
+    SF(builder->indices, calloc, NULL, (file->trackCt ? file->trackCt : 1, sizeof(struct NoteIndex)));
+    SF(builder->readers, malloc, NULL, ((file->trackCt + 1) * sizeof(struct SmfTrackReader *)));
+    for (ti = 0; ti < file->trackCt; ti++)
+        builder->readers[ti] = smfTrackOpen(file, ti);
+    builder->done = (file->trackCt == 0);
+
+    return builder;
+}
+
+/* add a note to an index which may be being read. The note (or its new
+ * array) must be visible before the count that covers it */
+static void indexAdd(struct NoteIndex *index, uint32_t tick, uint8_t velocity)
+{
+    if (index->count >= index->size) {
+        struct NoteIndexEntry *notes;
+        int32_t size = index->size ? index->size * 2 : 64;
+        SF(notes, malloc, NULL, (size * sizeof(struct NoteIndexEntry)));
+        if (index->count)
+            memcpy(notes, index->notes, index->count * sizeof(struct NoteIndexEntry));
+        if (index->notes) {
+            SF(index->outgrown, realloc, NULL, (index->outgrown,
+                (index->outgrownCt + 1) * sizeof(struct NoteIndexEntry *)));
+            index->outgrown[index->outgrownCt++] = index->notes;
+        }
+        __sync_synchronize();
+        index->notes = notes;
+        index->size = size;
+    }
+
+    index->notes[index->count].absoluteTm = tick;
+    index->notes[index->count].velocity = velocity;
+    __sync_synchronize();
+    index->count++;
+}
+
+int noteIndexBuilderExtend(struct NoteIndexBuilder *builder, uint32_t tick)
+{
+    struct SmfEvent event;
+    int ti, rd, done = 1;
+
+    if (builder->done) return 0;
+
+    for (ti = 0; ti < builder->file->trackCt; ti++) {
+        struct NoteIndex *index = builder->indices + ti;
+        struct SmfTrackReader *reader = builder->readers[ti];
+        if (!reader) continue;
+
+        while (!index->count || index->notes[index->count-1].absoluteTm <= tick) {
+            if ((rd = smfTrackRead(reader, &event)) <= 0) {
+                smfTrackClose(reader);
+                builder->readers[ti] = reader = NULL;
+                break;
+            }
+            if ((event.status >> 4) == MIDI_NOTE_ON && event.data[1] > 0)
+                indexAdd(index, event.tick, event.data[1]);
+        }
+        if (reader) done = 0;
+    }
+
+    if (tick > builder->horizon) builder->horizon = tick;
+    builder->done = done;
+    return !done;
+}
+
+void noteIndexBuilderFree(struct NoteIndexBuilder *builder)
+{
+    int ti;
+    for (ti = 0; ti < builder->file->trackCt; ti++)
+        if (builder->readers[ti]) smfTrackClose(builder->readers[ti]);
+    free(builder->readers);
+    free(builder);
+}
+
+void noteIndexFree(struct NoteIndex *indices, int trackCt)
+{
+    int ti;
+    if (!indices) return;
+    for (ti = 0; ti < trackCt; ti++) {
+        while (indices[ti].outgrownCt)
+            free(indices[ti].outgrown[--indices[ti].outgrownCt]);
+        free(indices[ti].outgrown);
+        free(indices[ti].notes);
+    }
+    free(indices);
+}
+
+struct NoteIndexEntry *noteIndexNext(struct NoteIndex *index, uint32_t atleast)
+{
+    int32_t lo, hi, mid, count;
+    struct NoteIndexEntry *notes;
+
+    /* it may be growing, so take the count before the notes it covers */
+    count = index->count;
+    __sync_synchronize();
+    notes = index->notes;
+
+    /* usually we're asked for the note just after the last one, so check
+     * there before searching */
+    lo = index->cursor;
+    if (lo < count && notes[lo].absoluteTm >= atleast &&
+        (lo == 0 || notes[lo-1].absoluteTm < atleast))
+        return notes + lo;
+    lo++;
+    if (lo < count && notes[lo].absoluteTm >= atleast &&
+        notes[lo-1].absoluteTm < atleast) {
+        index->cursor = lo;
+        return notes + lo;
+    }
+
+    /* otherwise, binary search for it */
+    lo = 0;
+    hi = count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (notes[mid].absoluteTm < atleast) lo = mid + 1;
+        else hi = mid;
+    }
+
+    index->cursor = lo;
+    if (lo >= count) return NULL;
+    return notes + lo;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NOTEINDEX_H
+#define NOTEINDEX_H
+
+#include "midifile/midifile.h"
+#include "smf.h"
+
+/* a single (sounding) note-on in a track */
+struct NoteIndexEntry {
+    uint32_t absoluteTm;
+    uint8_t velocity;
+};
+
+/* all of the note-ons of a single track, sorted by time */
+struct NoteIndex {
+    volatile int32_t count;
+    struct NoteIndexEntry * volatile notes;
+
+    /* where the last lookup ended, since lookups are usually in order */
+    int32_t cursor;
+
+    /* while building with a NoteIndexBuilder: room in notes, and the arrays
+     * it's outgrown, which a reader may still be using until it's freed */
+    int32_t size;
+    struct NoteIndexEntry **outgrown;
+    int outgrownCt;
+};
+
+/* indices being built a little at a time from a file on disk, for files
+ * which are decoded lazily. One thread can extend the indices while another
+ * looks up notes in them */
+struct NoteIndexBuilder {
+    struct SmfFile *file;
+    struct NoteIndex *indices;
+
+    /* the reader for each track, or NULL once it's fully indexed */
+    struct SmfTrackReader **readers;
+
+    /* every unfinished track is indexed up to its first note after this
+     * tick */
+    uint32_t horizon;
+    int done;
+};
+
+/* build an index for every track in a file (returns an array of
+ * file->trackCt indices) */
+struct NoteIndex *noteIndexBuild(MfFile *file);
+
+/* start indexing every track in a file on disk, without decoding it. Nothing
+ * is indexed until noteIndexBuilderExtend */
+struct NoteIndexBuilder *noteIndexBuilderNew(struct SmfFile *file);
+
+/* index every unfinished track up to its first note after tick. Returns 0 once
+ * every track is fully indexed */
+int noteIndexBuilderExtend(struct NoteIndexBuilder *builder, uint32_t tick);
+
+/* stop building. Doesn't free the indices, which are freed by noteIndexFree
+ * like any others */
+void noteIndexBuilderFree(struct NoteIndexBuilder *builder);
+
+/* free an array of indices built by noteIndexBuild or a builder */
+void noteIndexFree(struct NoteIndex *indices, int trackCt);
+
+/* find the first note-on at or after the given tick. Returns its entry, or
+ * NULL if there are no more notes */
+struct NoteIndexEntry *noteIndexNext(struct NoteIndex *index, uint32_t atleast);
+
+#endif
@@ -55,6 +55,9 @@ struct NoteTapperState {
     /* track control */
     int track;
 
+    /* which input device to listen to, or -1 for all */
+    int source;
+
     /* metronome */
     uint16_t timeDivision;
     int32_t lastTick;
@@ -69,7 +72,7 @@ int init(HS)
 {
     struct NoteTapperState *pstate;
     SF(pstate, calloc, NULL, (1, sizeof(struct NoteTapperState)));
-    pstate->track = -1;
+    pstate->track = pstate->source = -1;
     pstate->velocity = pstate->lastVelocity = 100;
     pstate->lastExpressionModVal = 64;
     hstate->pstate[pnum] = (void *) pstate;
@@ -84,6 +87,10 @@ int argHandler(HS, int *argi, char **argv)
         pstate->track = atoi(argv[++*argi]);
         ++*argi; return 1;
 
+    } else ARGN(s, source) {
+        pstate->source = atoi(argv[++*argi]);
+        ++*argi; return 1;
+
     } else ARG(r, tempo) {
         pstate->tempoMod = 1;
         ++*argi; return 1;
@@ -103,7 +110,7 @@ int argHandler(HS, int *argi, char **argv)
 int begin(HS)
 {
     STATE;
-    int i;
+    int rtrack;
 
     /* need an input device */
     if (hstate->idev == -1) {
@@ -116,16 +123,13 @@ int begin(HS)
         pstate->velocityMod = 1;
 
     if (pstate->expressionMod) {
-        /* set the expression of each channel; FIXME: always writes it into the 0
-         * track of the file, which will be redundant with multiple runs of
-         * mousebow */
-        for (i = 0; i < 16; i++) {
-            MfEvent *event;
-            PmMessage msg;
-            event = Mf_NewEvent();
-            msg = event->e.message = Pm_Message(Pm_MessageStatusGen(MIDI_CONTROLLER, i), 11 /* expression */, 64);
-            Pm_WriteShort(hstate->odstream, 0, msg);
-            Mf_StreamWriteOne(hstate->ofstream, 0, event);
+        /* set the expression of each track we'll modulate */
+        for (rtrack = (pstate->track < 0) ? 1 : pstate->track;
+                rtrack < ((pstate->track < 0) ? hstate->ifstream->file->trackCt : (pstate->track + 1));
+                rtrack++) {
+            PmMessage msg = Pm_Message(Pm_MessageStatusGen(MIDI_CONTROLLER, rtrack - 1), 11 /* expression */, 64);
+            hstate->writeOutputTrack(hstate, rtrack, msg);
+            hstate->writeEvent(hstate, rtrack, 0, msg);
         }
     }
 
@@ -146,6 +150,7 @@ int usage(HS)
 {
     fprintf(stderr, "notetapper usage: -p notetapper -i <input device> -t <track> [options]\n"
                     "notetapper options:\n"
+                    "\t-s|--source <n>: Only listen to the nth input device (from 0).\n"
                     "\t-r|--tempo: Modulate tempo.\n"
                     "\t-v|--velocity: Modulate velocity.\n"
                     "\t-e|--expression: Modulate expression (implies -v).\n");
@@ -162,17 +167,9 @@ static void findNextTick(HS, uint32_t atleast)
     for (rtrack = (pstate->track < 0) ? 0 : pstate->track;
          rtrack < ((pstate->track < 0) ? hstate->ifstream->file->trackCt : (pstate->track + 1));
          rtrack++) {
-        MfTrack *mtrack = hstate->ifstream->file->tracks[rtrack];
-        MfEvent *cur;
-        for (cur = mtrack->head; cur; cur = cur->next) {
-            if (cur->absoluteTm > earliest) break;
-            if (cur->absoluteTm >= atleast &&
-                Pm_MessageType(cur->e.message) == MIDI_NOTE_ON &&
-                Pm_MessageData2(cur->e.message) > 0) {
-                earliest = cur->absoluteTm;
-                break;
-            }
-        }
+        struct NoteIndexEntry *note = noteIndexNext(hstate->noteIndex + rtrack, atleast);
+        if (note && note->absoluteTm < earliest)
+            earliest = note->absoluteTm;
     }
     hstate->nextTick = earliest;
 }
@@ -219,18 +216,12 @@ static void handleBeat(HS, PtTimestamp ts)
         }
 
         if (tempo > 0) {
-            MfEvent *event;
-            MfMeta *meta;
+            unsigned char data[MIDI_M_TEMPO_LENGTH];
             Mf_StreamSetTempo(hstate->ifstream, ts, 0, curTick, tempo);
 
             /* produce the tempo event */
-            event = Mf_NewEvent();
-            event->absoluteTm = pstate->lastTick;
-            event->e.message = Pm_Message(MIDI_STATUS_META, 0, 0);
-            event->meta = meta = Mf_NewMeta(MIDI_M_TEMPO_LENGTH);
-            meta->type = MIDI_M_TEMPO;
-            MIDI_M_TEMPO_N_SET(meta->data, tempo);
-            Mf_StreamWriteOne(hstate->ofstream, 0, event);
+            MIDI_M_TEMPO_N_SET(data, tempo);
+            hstate->writeMeta(hstate, 0, pstate->lastTick, MIDI_M_TEMPO, MIDI_M_TEMPO_LENGTH, data);
 
         } else {
             /* always need to set some tick/tempo or the timing will be off */
@@ -283,10 +274,14 @@ void handleController(HS, PtTimestamp ts, uint8_t cnum, uint8_t val)
 int tickPreMidi(HS, PtTimestamp timestamp)
 {
     STATE;
-    PmEvent ev;
+    int32_t i;
+
+    /* look through this tick's input */
+    for (i = 0; i < hstate->inputCt; i++) {
+        PmEvent ev = hstate->input[i];
+        int32_t nextTick = hstate->nextTick;
+        if (pstate->source >= 0 && hstate->inputSource[i] != pstate->source) continue;
 
-    /* wait for an event from the input device */
-    while (Pm_Read(hstate->idstream, &ev, 1) == 1) {
         /* looking for a MIDI_NOTE_ON */
         uint8_t type = Pm_MessageType(ev.message);
         if (type == MIDI_NOTE_ON) {
@@ -307,6 +302,10 @@ int tickPreMidi(HS, PtTimestamp timestamp)
                 Pm_MessageData1(ev.message), Pm_MessageData2(ev.message));
 
         }
+
+        /* if that moved us on, it's what released the next notes */
+        if (hstate->nextTick != nextTick && hstate->released < 0)
+            hstate->released = i;
     }
 
     return 1;
@@ -316,7 +315,7 @@ int tickWithMidi(HS, PtTimestamp timestamp, uint32_t tmTick)
 {
     STATE;
     int rtrack;
-    MfEvent *event;
+    PmMessage msg;
 
     if (pstate->expressionMod && tmTick > pstate->lastExpressionMod) {
         int vol = ((double) pstate->velocity) / ((double) pstate->lastVelocity) * 64;
@@ -334,11 +333,9 @@ int tickWithMidi(HS, PtTimestamp timestamp, uint32_t tmTick)
         for (rtrack = (pstate->track < 0) ? 1 : pstate->track;
                 rtrack < ((pstate->track < 0) ? hstate->ifstream->file->trackCt : (pstate->track + 1));
                 rtrack++) {
-            event = Mf_NewEvent();
-            event->absoluteTm = tmTick;
-            event->e.message = Pm_Message(Pm_MessageStatusGen(MIDI_CONTROLLER, rtrack - 1), 11 /* expression */, vol);
-            Mf_StreamWriteOne(hstate->ofstream, rtrack, event);
-            Pm_WriteShort(hstate->odstream, 0, event->e.message);
+            msg = Pm_Message(Pm_MessageStatusGen(MIDI_CONTROLLER, rtrack - 1), 11 /* expression */, vol);
+            hstate->writeEvent(hstate, rtrack, tmTick, msg);
+            hstate->writeOutputTrack(hstate, rtrack, msg);
             pstate->lastExpressionMod = tmTick;
         }
     }
@@ -346,29 +343,32 @@ int tickWithMidi(HS, PtTimestamp timestamp, uint32_t tmTick)
     return 1;
 }
 
-int handleEvent(HS, PtTimestamp timestamp, uint32_t tick, int rtrack, MfEvent *event, int *writeOut)
+int handleEvents(HS, PtTimestamp timestamp, uint32_t tick, int count, MfEvent **events,
+    int *rtracks, int *play, int *writeOut)
 {
     STATE;
-    PmEvent ev = event->e;
+    int i;
 
     /* we only care about changing events at all if we're modifying velocity */
-    if (pstate->velocityMod) {
-        if (Pm_MessageType(ev.message) == MIDI_NOTE_ON) {
-            if (Pm_MessageData2(ev.message) != 0 &&
-                    (pstate->track == -1 || pstate->track == rtrack)) {
+    if (!pstate->velocityMod) return 1;
+
+    for (i = 0; i < count; i++) {
+        PmMessage msg = events[i]->e.message;
+        if (!play[i]) continue;
+        if (Pm_MessageType(msg) == MIDI_NOTE_ON) {
+            if (Pm_MessageData2(msg) != 0 &&
+                    (pstate->track == -1 || pstate->track == rtracks[i])) {
                 /* change the velocity */
-                ev.message = Pm_Message(
-                        Pm_MessageStatus(ev.message),
-                        Pm_MessageData1(ev.message),
+                events[i]->e.message = Pm_Message(
+                        Pm_MessageStatus(msg),
+                        Pm_MessageData1(msg),
                         pstate->lastVelocity);
 
                 /* and write it to our output */
-                *writeOut = 1;
+                writeOut[i] = 1;
             }
         }
     }
 
-    event->e = ev;
-
     return 1;
 }
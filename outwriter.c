@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "outwriter.h"
+
+static void *outputWriterThread(void *vpwriter)
+{
+    struct OutputWriter *writer = (struct OutputWriter *) vpwriter;
+    FILE *ofh;
+
+    /* wait for our file */
+    pthread_mutex_lock(&writer->lock);
+    while (!writer->submitted)
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    pthread_mutex_unlock(&writer->lock);
+
+    /* write it out */
+    SF(ofh, fopen, NULL, (writer->filename, "wb"));
+    Mf_WriteMidiFile(ofh, writer->file);
+    fclose(ofh);
+    if (writer->freeFile) writer->freeFile(writer->file, writer->arg);
+    else Mf_FreeFile(writer->file);
+    if (writer->discard) Mf_FreeFile(writer->discard);
+    writer->file = writer->discard = NULL;
+
+    if (writer->done) writer->done(writer->arg);
+
+    return NULL;
+}
+
+void outputWriterStart(struct OutputWriter *writer, const char *filename,
+    void (*done)(void *), void *arg)
+{
+    int tmpi;
+
+    memset(writer, 0, sizeof(struct OutputWriter));
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    writer->filename = filename;
+    writer->done = done;
+    writer->arg = arg;
+
+    tmpi = pthread_create(&writer->thread, NULL, outputWriterThread, writer);
+    if (tmpi != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(tmpi));
+        exit(1);
+    }
+}
+
+void outputWriterSubmit(struct OutputWriter *writer, MfFile *file, MfFile *discard)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->file = file;
+    writer->discard = discard;
+    writer->submitted = 1;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+void outputWriterJoin(struct OutputWriter *writer)
+{
+    pthread_join(writer->thread, NULL);
+}
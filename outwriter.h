@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef OUTWRITER_H
+#define OUTWRITER_H
+
+#include <pthread.h>
+
+#include "midifile/midifile.h"
+
+/* writes a finished MIDI file from a thread of its own, so that the timer
+ * callback which finishes it needn't wait for it */
+struct OutputWriter {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* where to write it */
+    const char *filename;
+
+    /* the file to write, and another file to free when we're done (usually
+     * the input file) */
+    MfFile *file, *discard;
+    int submitted;
+
+    /* called from the writer thread after the file has been written */
+    void (*done)(void *arg);
+    void *arg;
+
+    /* how to free the written file (Mf_FreeFile if NULL). May be set any time
+     * before submitting */
+    void (*freeFile)(MfFile *file, void *arg);
+};
+
+/* start a writer thread, which will wait for a file to be submitted. done may
+ * be NULL */
+void outputWriterStart(struct OutputWriter *writer, const char *filename,
+    void (*done)(void *), void *arg);
+
+/* hand off a finished file (and optionally another file to free) to be
+ * written. Safe to call from the timer thread; returns immediately */
+void outputWriterSubmit(struct OutputWriter *writer, MfFile *file, MfFile *discard);
+
+/* wait for the writer to finish */
+void outputWriterJoin(struct OutputWriter *writer);
+
+#endif
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "midifile/midi.h"
+#include "midifile/midifile.h"
+#include "midifile/midifstream.h"
+#include "passes.h"
+
+static MfFile *runVelMap(MfFile *file, struct PassStep *step);
+static MfFile *runTimeSigFix(MfFile *file, struct PassStep *step);
+static MfFile *runTempoSmooth(MfFile *file, struct PassStep *step);
+
+static const struct Pass passes[] = {
+    {"reducevel", runVelMap, PASS_ARG_CURVE, -1,
+        "reducevel:<curve>[+<curve>...]\n"
+        "                    apply velocity curves, as hreducevel does"},
+    {"timesigfix", runTimeSigFix, PASS_ARG_NONE, 0,
+        "timesigfix          fix time signature metronomes"},
+    {"temposmooth", runTempoSmooth, PASS_ARG_INT, 16,
+        "temposmooth[:<n>]   smooth tempo changes over n steps (default 16)"},
+    {NULL, NULL, PASS_ARG_NONE, 0, NULL}
+};
+
+static MfFile *runVelMap(MfFile *file, struct PassStep *step)
+{
+    return passVelMap(file, step->map);
+}
+
+static MfFile *runTimeSigFix(MfFile *file, struct PassStep *step)
+{
+    return passTimeSigFix(file, step->arg);
+}
+
+static MfFile *runTempoSmooth(MfFile *file, struct PassStep *step)
+{
+    return passTempoSmooth(file, step->arg);
+}
+
+MfFile *passVelMap(MfFile *file, struct VelMap *map)
+{
+    int ti;
+    MfTrack *track;
+    MfEvent *cur;
+    const struct VelTable *table;
+
+    for (ti = 0; ti < file->trackCt; ti++) {
+        track = file->tracks[ti];
+        table = velMapTable(map, ti);
+        cur = track->head;
+        while (cur) {
+            if (Pm_MessageType(cur->e.message) == MIDI_NOTE_ON) {
+                cur->e.message = Pm_Message(
+                    Pm_MessageStatus(cur->e.message),
+                    Pm_MessageData1(cur->e.message),
+                    table->data2[((Pm_MessageStatus(cur->e.message) & 0xF) << 7) |
+                                 (Pm_MessageData2(cur->e.message) & 0x7F)] >> 16);
+            }
+            cur = cur->next;
+        }
+    }
+
+    return file;
+}
+
+#define DENOM_TICKS (96>>denom)
+
+/* figure out a metronome value for the given time signature
+ * for no good reason, this has some support for numerators up to 20 */
+static uint8_t metro(uint8_t numer, uint8_t denom)
+{
+    switch (numer) {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+        case 4: /* common time and friends */
+        case 5:
+        case 7:
+        case 11:
+        case 13:
+        case 17:
+        case 19:
+            return DENOM_TICKS;
+
+        case 10:
+            return DENOM_TICKS * 2;
+
+        case 6:
+        case 9:
+        case 12:
+            return DENOM_TICKS * 3;
+
+        case 8:
+        case 16:
+            return DENOM_TICKS * 4;
+
+        case 15:
+        case 20:
+            return DENOM_TICKS * 5;
+
+        case 18:
+            return DENOM_TICKS * 6;
+
+        case 14:
+            return DENOM_TICKS * 7;
+
+        default:
+            return metro(numer/2, (denom>0)?(denom-1):0);
+    }
+}
+
+MfFile *passTimeSigFix(MfFile *file, int arg)
+{
+    int ti;
+    MfTrack *track;
+    MfEvent *cur;
+
+    for (ti = 0; ti < file->trackCt; ti++) {
+        track = file->tracks[ti];
+        cur = track->head;
+        while (cur) {
+            if (cur->meta && cur->meta->type == MIDI_M_TIME_SIGNATURE &&
+                cur->meta->length == MIDI_M_TIME_SIGNATURE_LENGTH) {
+                /* fix this time signature */
+                uint8_t numer = MIDI_M_TIME_SIGNATURE_NUMERATOR(cur->meta->data);
+                uint8_t denom = MIDI_M_TIME_SIGNATURE_DENOMINATOR(cur->meta->data);
+                MIDI_M_TIME_SIGNATURE_METRONOME(cur->meta->data) =
+                    metro(numer, denom);
+            }
+            cur = cur->next;
+        }
+    }
+
+    return file;
+}
+
+MfFile *passTempoSmooth(MfFile *imf, int steps)
+{
+    MfFile *omf;
+    MfStream *ims, *oms;
+    int i;
+    MfEvent *event, *sEvent;
+    MfMeta *meta;
+    int track;
+    uint32_t lastTempoTick = 0;
+    int32_t lastTempo = 0;
+
+    ims = Mf_OpenStream(imf);
+    omf = Mf_NewFile(imf->timeDivision);
+    oms = Mf_OpenStream(omf);
+
+    while (Mf_StreamReadUntil(ims, &event, &track, 1, (uint32_t) -1) == 1) {
+        /* if it's a tempo event ... */
+        if (event->meta && event->meta->type == MIDI_M_TEMPO) {
+            int32_t newTempo = MIDI_M_TEMPO_N(event->meta->data);
+
+            /* smooth out until here */
+            if (lastTempo != 0) {
+                for (i = 0; i < steps; i++) {
+                    /* smooth out the tick and tempo */
+                    uint32_t sTick = lastTempoTick + (event->absoluteTm - lastTempoTick) * i / steps;
+                    int32_t sTempo = lastTempo + (newTempo - lastTempo) * i / steps;
+
+                    /* make the new event */
+                    sEvent = Mf_NewEvent();
+                    sEvent->absoluteTm = sTick;
+                    sEvent->e.message = Pm_Message(MIDI_STATUS_META, 0, 0);
+                    sEvent->meta = meta = Mf_NewMeta(3);
+                    meta->type = MIDI_M_TEMPO;
+                    meta->data[0] = (sTempo >> 16) & 0xFF;
+                    meta->data[1] = (sTempo >> 8) & 0xFF;
+                    meta->data[2] = sTempo & 0xFF;
+                    Mf_StreamWriteOne(oms, track, sEvent);
+                }
+            }
+
+            lastTempoTick = event->absoluteTm;
+            lastTempo = newTempo;
+
+            event->deltaTm = event->e.timestamp = 0;
+            Mf_StreamWriteOne(oms, 0, event);
+
+        } else if (!event->meta) {
+            /* just write it out (best not be on the tempo track! */
+            sEvent = Mf_NewEvent();
+            sEvent->absoluteTm = event->absoluteTm;
+            sEvent->e.message = event->e.message;
+            Mf_StreamWriteOne(oms, track, sEvent);
+
+        } else if (event->meta->type != SMF_META_END_OF_TRACK ||
+                   Pm_MessageStatus(event->e.message) != MIDI_STATUS_META) {
+            /* any other meta (time signatures, names, markers, ...) stays as
+             * it was, in its own track. Ends of tracks are still left out,
+             * since tempos from other tracks move to track 0, and could land
+             * after its end */
+            event->deltaTm = event->e.timestamp = 0;
+            Mf_StreamWriteOne(oms, track, event);
+
+        }
+    }
+
+    imf = Mf_CloseStream(ims);
+    Mf_FreeFile(imf);
+    return Mf_CloseStream(oms);
+}
+
+void patchVelMap(struct SmfRawEvent *event, void *arg)
+{
+    const struct VelTable *table;
+    if ((event->status >> 4) == MIDI_NOTE_ON) {
+        table = velMapTable((struct VelMap *) arg, event->track);
+        event->data[1] = table->data2[((event->status & 0xF) << 7) | (event->data[1] & 0x7F)] >> 16;
+    }
+}
+
+void patchTimeSigFix(struct SmfRawEvent *event, void *arg)
+{
+    if (event->status == SMF_STATUS_META &&
+        event->metaType == MIDI_M_TIME_SIGNATURE &&
+        event->length == MIDI_M_TIME_SIGNATURE_LENGTH) {
+        MIDI_M_TIME_SIGNATURE_METRONOME(event->data) = metro(
+            MIDI_M_TIME_SIGNATURE_NUMERATOR(event->data),
+            MIDI_M_TIME_SIGNATURE_DENOMINATOR(event->data));
+    }
+}
+
+void colPassVelMap(struct ColFile *file, struct VelMap *map)
+{
+    int ti;
+    for (ti = 0; ti < file->trackCt; ti++)
+        velApply(velMapTable(map, ti), file->tracks[ti].messages, file->tracks[ti].count);
+}
+
+void colPassTimeSigFix(struct ColFile *file)
+{
+    int ti;
+    uint32_t i;
+
+    for (ti = 0; ti < file->trackCt; ti++) {
+        int32_t *metas = file->tracks[ti].metas;
+        uint32_t count = file->tracks[ti].count;
+
+        for (i = 0; i < count; i++) {
+            struct ColMeta *meta;
+            if (metas[i] < 0) continue;
+            meta = COL_META(file, metas[i]);
+            if (meta->type == MIDI_M_TIME_SIGNATURE &&
+                meta->length == MIDI_M_TIME_SIGNATURE_LENGTH &&
+                Pm_MessageStatus(file->tracks[ti].messages[i]) == MIDI_STATUS_META) {
+                MIDI_M_TIME_SIGNATURE_METRONOME(meta->data) = metro(
+                    MIDI_M_TIME_SIGNATURE_NUMERATOR(meta->data),
+                    MIDI_M_TIME_SIGNATURE_DENOMINATOR(meta->data));
+            }
+        }
+    }
+}
+
+/* the pass with this name, if any */
+static const struct Pass *findPass(const char *name, size_t len)
+{
+    int i;
+    for (i = 0; passes[i].name; i++)
+        if (strlen(passes[i].name) == len && !strncmp(passes[i].name, name, len))
+            return &passes[i];
+    return NULL;
+}
+
+/* does a pass start here? */
+static int passStarts(const char *item)
+{
+    return findPass(item, strcspn(item, ":,")) != NULL;
+}
+
+int passesParse(const char *spec, struct PassStep **steps)
+{
+    char *buf, *item, *next, *arg, *curve, *saveptr;
+    int ct = 0, sz = 8;
+
+    SF(buf, strdup, NULL, (spec));
+    SF(*steps, malloc, NULL, (sz * sizeof(struct PassStep)));
+
+    for (item = buf; item; item = next) {
+        const struct Pass *pass;
+
+        /* find the end of this item. A curve may have commas of its own, so
+         * it only ends where another pass starts */
+        pass = findPass(item, strcspn(item, ":,"));
+        next = item;
+        while ((next = strchr(next, ','))) {
+            next++;
+            if (!pass || pass->argType != PASS_ARG_CURVE || passStarts(next)) {
+                next[-1] = '\0';
+                break;
+            }
+        }
+
+        if ((arg = strchr(item, ':'))) *arg++ = '\0';
+        if (!pass) {
+            fprintf(stderr, "Unrecognized pass %s\n", item);
+            goto error;
+        }
+
+        if (ct >= sz) {
+            sz *= 2;
+            SF(*steps, realloc, NULL, (*steps, sz * sizeof(struct PassStep)));
+        }
+        (*steps)[ct].pass = pass;
+        (*steps)[ct].arg = pass->defaultArg;
+        (*steps)[ct].map = NULL;
+        ct++;
+
+        if (!arg) {
+            if (pass->defaultArg < 0) {
+                fprintf(stderr, "Pass %s requires an argument\n", pass->name);
+                goto error;
+            }
+            continue;
+        }
+
+        switch (pass->argType) {
+            case PASS_ARG_NONE:
+                fprintf(stderr, "Pass %s takes no argument\n", pass->name);
+                goto error;
+
+            case PASS_ARG_INT:
+                (*steps)[ct-1].arg = atoi(arg);
+                if ((*steps)[ct-1].arg <= 0) {
+                    fprintf(stderr, "Invalid argument to %s: %s\n", pass->name, arg);
+                    goto error;
+                }
+                break;
+
+            case PASS_ARG_CURVE:
+                /* later curves override earlier ones, as with hreducevel */
+                (*steps)[ct-1].map = velMapNew();
+                for (curve = strtok_r(arg, "+", &saveptr); curve; curve = strtok_r(NULL, "+", &saveptr))
+                    if (!velMapParse((*steps)[ct-1].map, curve)) goto error;
+                break;
+        }
+    }
+
+    free(buf);
+    return ct;
+
+error:
+    free(buf);
+    passesFree(*steps, ct);
+    *steps = NULL;
+    return -1;
+}
+
+void passesFree(struct PassStep *steps, int ct)
+{
+    int i;
+    for (i = 0; i < ct; i++)
+        if (steps[i].map) velMapFree(steps[i].map);
+    free(steps);
+}
+
+MfFile *passesRun(MfFile *file, struct PassStep *steps, int ct)
+{
+    int i;
+    for (i = 0; i < ct; i++)
+        file = steps[i].pass->run(file, &steps[i]);
+    return file;
+}
+
+void passesUsage(FILE *to)
+{
+    int i;
+    for (i = 0; passes[i].name; i++)
+        fprintf(to, "  %s\n", passes[i].desc);
+    velMapUsage(to);
+}
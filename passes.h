@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <stdio.h>
+
+#include "colfile.h"
+#include "midifile/midifile.h"
+#include "smf.h"
+#include "velcurve.h"
+
+struct PassStep;
+
+/* the offline transforms, as passes over an in-memory file. Each takes a file
+ * and an argument and returns the transformed file, which may be the same
+ * file (transformed in place) or a new one (in which case the old one has been
+ * freed) */
+typedef MfFile *(*PassFunc)(MfFile *file, struct PassStep *step);
+
+/* apply velocity curves (hreducevel's) */
+MfFile *passVelMap(MfFile *file, struct VelMap *map);
+
+/* give time signature metas proper metronomes (arg unused) */
+MfFile *passTimeSigFix(MfFile *file, int arg);
+
+/* smooth out tempo changes over steps steps */
+MfFile *passTempoSmooth(MfFile *file, int steps);
+
+/* the same transforms, for those which don't change any lengths, as patches
+ * for smfPatch to apply to a file in place. For velocities, arg is a VelMap */
+void patchVelMap(struct SmfRawEvent *event, void *arg);
+void patchTimeSigFix(struct SmfRawEvent *event, void *arg);
+
+/* the same transforms again, over columnar files */
+void colPassVelMap(struct ColFile *file, struct VelMap *map);
+void colPassTimeSigFix(struct ColFile *file);
+
+/* the kinds of argument a pass can take */
+enum PassArg {
+    PASS_ARG_NONE = 0,
+    PASS_ARG_INT,       /* a positive integer */
+    PASS_ARG_CURVE      /* velocity curves, as for velMapParse, joined by + */
+};
+
+/* a named pass */
+struct Pass {
+    const char *name;
+    PassFunc run;
+    enum PassArg argType;
+    int defaultArg; /* defaultArg < 0 means the argument is required */
+    const char *desc;
+};
+
+/* a pass to run, with its argument */
+struct PassStep {
+    const struct Pass *pass;
+    int arg;
+    struct VelMap *map; /* for PASS_ARG_CURVE */
+};
+
+/* parse a comma-separated list of passes, like "reducevel:4,timesigfix".
+ * Commas in a curve (points:0/0,127/100) are part of it, up to the next pass
+ * name. Returns the number of steps, or -1 (with a message) if it's invalid.
+ * *steps must be freed with passesFree */
+int passesParse(const char *spec, struct PassStep **steps);
+
+/* free parsed steps */
+void passesFree(struct PassStep *steps, int ct);
+
+/* run the steps over a file, returning the final file */
+MfFile *passesRun(MfFile *file, struct PassStep *steps, int ct);
+
+/* list the known passes */
+void passesUsage(FILE *to);
+
+#endif
@@ -28,6 +28,7 @@
 #include "helpers.h"
 #include "midifile/midi.h"
 #include "midifile/midifstream.h"
+#include "outwriter.h"
 #include "pmhelpers.h"
 
 MfStream *ifstream = NULL;
@@ -36,6 +37,7 @@ PortMidiStream *idstream = NULL;
 PortMidiStream *odstream = NULL;
 int ready = 0;
 char *tfile = NULL;
+struct OutputWriter outputWriter;
 
 void dump(PtTimestamp timestamp, void *ignore);
 
@@ -127,9 +129,12 @@ int main(int argc, char **argv)
     ifstream = Mf_OpenStream(pf);
     Mf_StartStream(ifstream, Pt_Time());
 
+    outputWriterStart(&outputWriter, tfile, NULL, NULL);
     ready = 1;
 
-    while (1) Pt_Sleep(1<<30);
+    /* wait for the output to be written */
+    outputWriterJoin(&outputWriter);
+    Pm_Terminate();
 
     return 0;
 }
@@ -199,15 +204,8 @@ void dump(PtTimestamp timestamp, void *ignore)
     }
 
     if (Mf_StreamEmpty(ifstream) == TRUE) {
-        MfFile *of;
-        FILE *ofh;
-        Mf_FreeFile(Mf_CloseStream(ifstream));
-        of = Mf_CloseStream(tstream);
-        SF(ofh, fopen, NULL, (tfile, "wb"));
-        Mf_WriteMidiFile(ofh, of);
-        fclose(ofh);
-        Mf_FreeFile(of);
-        Pm_Terminate();
-        exit(0);
+        /* hand it off to be written, we're done */
+        ready = 0;
+        outputWriterSubmit(&outputWriter, Mf_CloseStream(tstream), Mf_CloseStream(ifstream));
     }
 }
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "ringbuffer.h"
+
+struct RingBuffer *ringBufferNew(size_t elSize, size_t size)
+{
+    struct RingBuffer *ring;
+    size_t rsize;
+
+    /* round up to a power of two, so we can just mask the indices */
+    for (rsize = 1; rsize < size; rsize <<= 1);
+
+    SF(ring, calloc, NULL, (1, sizeof(struct RingBuffer)));
+    SF(ring->buf, malloc, NULL, (elSize * rsize));
+    ring->elSize = elSize;
+    ring->size = rsize;
+    return ring;
+}
+
+void ringBufferFree(struct RingBuffer *ring)
+{
+    free(ring->buf);
+    free(ring);
+}
+
+int ringBufferPush(struct RingBuffer *ring, const void *el)
+{
+    size_t head = ring->head;
+    if (head - ring->tail >= ring->size) return 0;
+
+    memcpy(ring->buf + (head & (ring->size - 1)) * ring->elSize, el, ring->elSize);
+
+    /* the element must be visible before the new head is */
+    __sync_synchronize();
+    ring->head = head + 1;
+    return 1;
+}
+
+int ringBufferPop(struct RingBuffer *ring, void *el)
+{
+    size_t tail = ring->tail;
+    if (tail == ring->head) return 0;
+
+    /* don't read the element until we've seen the head */
+    __sync_synchronize();
+    memcpy(el, ring->buf + (tail & (ring->size - 1)) * ring->elSize, ring->elSize);
+
+    /* and don't release the slot until we've read it */
+    __sync_synchronize();
+    ring->tail = tail + 1;
+    return 1;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <stddef.h>
+
+/* a lock-free single-producer, single-consumer ring buffer of fixed-size
+ * elements. Pushing and popping never allocate, so the producer can be the
+ * timer thread. */
+struct RingBuffer {
+    size_t elSize, size; /* size is a power of two */
+    volatile size_t head, tail; /* next to push, next to pop */
+    unsigned char *buf;
+};
+
+/* allocate a ring buffer of at least the given number of elements */
+struct RingBuffer *ringBufferNew(size_t elSize, size_t size);
+
+void ringBufferFree(struct RingBuffer *ring);
+
+/* push an element (producer only). Returns 0 if the buffer is full */
+int ringBufferPush(struct RingBuffer *ring, const void *el);
+
+/* pop an element (consumer only). Returns 0 if the buffer is empty */
+int ringBufferPop(struct RingBuffer *ring, void *el);
+
+#endif
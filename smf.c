@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "smf.h"
+
+/* reading helpers, which return -1 at the end of the chunk */
+static int readByte(struct SmfTrackReader *reader)
+{
+    if (reader->left == 0) return -1;
+    reader->left--;
+    return *reader->p++;
+}
+
+static int readVLQ(struct SmfTrackReader *reader, uint32_t *into)
+{
+    int i, c;
+    uint32_t v = 0;
+    for (i = 0; i < 4; i++) {
+        if ((c = readByte(reader)) < 0) return -1;
+        v = (v << 7) | (c & 0x7F);
+        if (!(c & 0x80)) {
+            *into = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* skip length bytes, returning where they were */
+static unsigned char *readBytes(struct SmfTrackReader *reader, uint32_t length)
+{
+    unsigned char *bytes = reader->p;
+    if (length > reader->left) return NULL;
+    reader->p += length;
+    reader->left -= length;
+    return bytes;
+}
+
+static uint32_t memN(const unsigned char *p, int bytes)
+{
+    uint32_t v = 0;
+    int i;
+    for (i = 0; i < bytes; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/* writing helpers */
+static void writeN(FILE *f, uint32_t n, int bytes)
+{
+    int i;
+    for (i = bytes - 1; i >= 0; i--)
+        putc((n >> (i * 8)) & 0xFF, f);
+}
+
+static void writeVLQ(FILE *f, uint32_t v)
+{
+    unsigned char buf[5];
+    int i = 0;
+    buf[i++] = v & 0x7F;
+    while ((v >>= 7))
+        buf[i++] = 0x80 | (v & 0x7F);
+    while (i > 0)
+        putc(buf[--i], f);
+}
+
+int smfDataLength(uint8_t status)
+{
+    switch (status >> 4) {
+        case 0xC:
+        case 0xD:
+            return 1;
+
+        case 0xF:
+            if (status == 0xF1 || status == 0xF3) return 1;
+            if (status == 0xF2) return 2;
+            return 0;
+
+        default:
+            return 2;
+    }
+}
+
+struct SmfFile *smfOpen(const char *filename)
+{
+    struct SmfFile *file;
+    int fd;
+    struct stat sbuf;
+    unsigned char *data;
+    size_t size, pos;
+    uint32_t length, trackCt;
+    int trackSz = 16;
+
+    SF(fd, open, -1, (filename, O_RDONLY));
+    if (fstat(fd, &sbuf) < 0) {
+        perror(filename);
+        close(fd);
+        return NULL;
+    }
+    size = sbuf.st_size;
+
+    /* the header */
+    if (size < 14) {
+        fprintf(stderr, "%s is not a MIDI file.\n", filename);
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(filename);
+        return NULL;
+    }
+    length = memN(data + 4, 4);
+    if (memcmp(data, "MThd", 4) || length < 6 || length > size - 8) {
+        fprintf(stderr, "%s is not a MIDI file.\n", filename);
+        munmap(data, size);
+        return NULL;
+    }
+    trackCt = memN(data + 10, 2);
+
+    SF(file, calloc, NULL, (1, sizeof(struct SmfFile)));
+    SF(file->filename, strdup, NULL, (filename));
+    file->data = data;
+    file->size = size;
+    file->format = memN(data + 8, 2);
+    file->timeDivision = memN(data + 12, 2);
+    SF(file->trackOffsets, malloc, NULL, (trackSz * sizeof(long)));
+    SF(file->trackLengths, malloc, NULL, (trackSz * sizeof(uint32_t)));
+
+    /* then find the tracks, skipping any other chunks. A truncated last track
+     * is read as far as it goes */
+    pos = 8 + (size_t) length;
+    while (pos + 8 <= size) {
+        length = memN(data + pos + 4, 4);
+        if (length > size - pos - 8) {
+            fprintf(stderr, "Warning: %s is truncated.\n", filename);
+            length = size - pos - 8;
+        }
+        if (!memcmp(data + pos, "MTrk", 4)) {
+            if (file->trackCt >= trackSz) {
+                trackSz *= 2;
+                SF(file->trackOffsets, realloc, NULL, (file->trackOffsets, trackSz * sizeof(long)));
+                SF(file->trackLengths, realloc, NULL, (file->trackLengths, trackSz * sizeof(uint32_t)));
+            }
+            file->trackOffsets[file->trackCt] = pos + 8;
+            file->trackLengths[file->trackCt] = length;
+            file->trackCt++;
+        }
+        pos += 8 + (size_t) length;
+    }
+
+    if (file->trackCt != trackCt)
+        fprintf(stderr, "Warning: %s claims %u tracks, but has %u.\n", filename,
+            (unsigned) trackCt, (unsigned) file->trackCt);
+
+    return file;
+}
+
+void smfClose(struct SmfFile *file)
+{
+    munmap(file->data, file->size);
+    free(file->filename);
+    free(file->trackOffsets);
+    free(file->trackLengths);
+    free(file);
+}
+
+struct SmfTrackReader *smfTrackOpen(struct SmfFile *file, int track)
+{
+    struct SmfTrackReader *reader;
+
+    SF(reader, calloc, NULL, (1, sizeof(struct SmfTrackReader)));
+    reader->p = file->data + file->trackOffsets[track];
+    reader->left = file->trackLengths[track];
+
+    return reader;
+}
+
+int smfTrackRead(struct SmfTrackReader *reader, struct SmfEvent *event)
+{
+    uint32_t delta;
+    int c, i, dataLength;
+
+    if (reader->done) return 0;
+    if (reader->left == 0) {
+        /* ended without an end-of-track event, but that's OK */
+        reader->done = 1;
+        return 0;
+    }
+
+    if (readVLQ(reader, &delta) < 0 || (c = readByte(reader)) < 0) return -1;
+    reader->tick += delta;
+    event->tick = reader->tick;
+
+    if (c == SMF_STATUS_META) {
+        if ((c = readByte(reader)) < 0 ||
+            readVLQ(reader, &event->length) < 0 ||
+            !(event->bytes = readBytes(reader, event->length)))
+            return -1;
+        event->status = SMF_STATUS_META;
+        event->metaType = c;
+        reader->runningStatus = 0;
+        if (event->metaType == SMF_META_END_OF_TRACK) {
+            reader->done = reader->endOfTrack = 1;
+            return 0;
+        }
+        return 1;
+
+    } else if (c == SMF_STATUS_SYSEX || c == SMF_STATUS_SYSEX_ESCAPE) {
+        if (readVLQ(reader, &event->length) < 0 ||
+            !(event->bytes = readBytes(reader, event->length)))
+            return -1;
+        event->status = c;
+        reader->runningStatus = 0;
+        return 1;
+
+    }
+
+    /* a channel message, perhaps in running status */
+    event->length = 0;
+    event->bytes = NULL;
+    event->data[0] = event->data[1] = 0;
+    if (c & 0x80) {
+        event->status = reader->runningStatus = c;
+        i = 0;
+    } else {
+        if (!reader->runningStatus) return -1;
+        event->status = reader->runningStatus;
+        event->data[0] = c;
+        i = 1;
+    }
+    dataLength = smfDataLength(event->status);
+    for (; i < dataLength; i++) {
+        if ((c = readByte(reader)) < 0) return -1;
+        event->data[i] = c;
+    }
+
+    return 1;
+}
+
+void smfTrackClose(struct SmfTrackReader *reader)
+{
+    free(reader);
+}
+
+struct SmfWriter *smfWriterOpen(const char *filename, uint16_t format,
+    uint16_t trackCt, uint16_t timeDivision)
+{
+    struct SmfWriter *writer;
+
+    SF(writer, calloc, NULL, (1, sizeof(struct SmfWriter)));
+    SF(writer->f, fopen, NULL, (filename, "wb"));
+    writer->trackCt = trackCt;
+
+    fwrite("MThd", 1, 4, writer->f);
+    writeN(writer->f, 6, 4);
+    writeN(writer->f, format, 2);
+    writeN(writer->f, trackCt, 2);
+    writeN(writer->f, timeDivision, 2);
+
+    return writer;
+}
+
+void smfWriterBeginTrack(struct SmfWriter *writer)
+{
+    fwrite("MTrk", 1, 4, writer->f);
+    writer->lengthAt = ftell(writer->f);
+    writeN(writer->f, 0, 4); /* filled in by smfWriterEndTrack */
+    writer->tick = 0;
+    writer->runningStatus = 0;
+}
+
+void smfWriterEvent(struct SmfWriter *writer, const struct SmfEvent *event)
+{
+    FILE *f = writer->f;
+
+    writeVLQ(f, (event->tick > writer->tick) ? event->tick - writer->tick : 0);
+    if (event->tick > writer->tick) writer->tick = event->tick;
+
+    if (event->status == SMF_STATUS_META) {
+        putc(SMF_STATUS_META, f);
+        putc(event->metaType, f);
+        writeVLQ(f, event->length);
+        fwrite(event->bytes, 1, event->length, f);
+        writer->runningStatus = 0;
+
+    } else if (event->status == SMF_STATUS_SYSEX || event->status == SMF_STATUS_SYSEX_ESCAPE) {
+        putc(event->status, f);
+        writeVLQ(f, event->length);
+        fwrite(event->bytes, 1, event->length, f);
+        writer->runningStatus = 0;
+
+    } else {
+        if (event->status != writer->runningStatus) {
+            putc(event->status, f);
+            writer->runningStatus = event->status;
+        }
+        fwrite(event->data, 1, smfDataLength(event->status), f);
+
+    }
+}
+
+void smfWriterText(struct SmfWriter *writer, uint32_t tick, const char *text)
+{
+    struct SmfEvent event;
+    event.tick = tick;
+    event.status = SMF_STATUS_META;
+    event.metaType = 0x01; /* text */
+    event.length = strlen(text);
+    event.bytes = (unsigned char *) text;
+    smfWriterEvent(writer, &event);
+}
+
+void smfWriterEndTrack(struct SmfWriter *writer)
+{
+    smfWriterEndTrackAt(writer, writer->tick);
+}
+
+void smfWriterEndTrackAt(struct SmfWriter *writer, uint32_t tick)
+{
+    long end;
+
+    writeVLQ(writer->f, (tick > writer->tick) ? tick - writer->tick : 0);
+    if (tick > writer->tick) writer->tick = tick;
+    putc(SMF_STATUS_META, writer->f);
+    putc(SMF_META_END_OF_TRACK, writer->f);
+    putc(0, writer->f);
+
+    /* now we know how long it was */
+    end = ftell(writer->f);
+    fseek(writer->f, writer->lengthAt, SEEK_SET);
+    writeN(writer->f, end - writer->lengthAt - 4, 4);
+    fseek(writer->f, end, SEEK_SET);
+
+    writer->tracksWritten++;
+}
+
+int smfWriterClose(struct SmfWriter *writer)
+{
+    int ok;
+
+    /* fill in any tracks we promised but didn't write */
+    while (writer->tracksWritten < writer->trackCt) {
+        smfWriterBeginTrack(writer);
+        smfWriterEndTrack(writer);
+    }
+
+    ok = !ferror(writer->f);
+    if (fclose(writer->f) != 0) ok = 0;
+    free(writer);
+    return ok;
+}
+
+/* read a VLQ from memory, returning its length or 0 if it runs off the end */
+static int memVLQ(const unsigned char *p, uint32_t left, uint32_t *into)
+{
+    int i;
+    uint32_t v = 0;
+    for (i = 0; i < 4 && (uint32_t) i < left; i++) {
+        v = (v << 7) | (p[i] & 0x7F);
+        if (!(p[i] & 0x80)) {
+            *into = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/* patch the events of one track chunk, or with no patch, just check it.
+ * Returns 0 if it's corrupt */
+static int patchTrack(unsigned char *p, uint32_t length, int track,
+    SmfPatchFunc patch, void *arg)
+{
+    struct SmfRawEvent event;
+    uint32_t i = 0, delta;
+    uint8_t runningStatus = 0;
+    int vl, dataLength;
+
+    event.track = track;
+    event.tick = 0;
+
+    while (i < length) {
+        if (!(vl = memVLQ(p + i, length - i, &delta))) return 0;
+        i += vl;
+        event.tick += delta;
+        if (i >= length) return 0;
+
+        if (p[i] == SMF_STATUS_META) {
+            if (i + 1 >= length) return 0;
+            event.status = SMF_STATUS_META;
+            event.metaType = p[i+1];
+            i += 2;
+            if (!(vl = memVLQ(p + i, length - i, &event.length))) return 0;
+            i += vl;
+            if (event.length > length - i) return 0;
+            if (event.metaType == SMF_META_END_OF_TRACK) return 1;
+            runningStatus = 0;
+
+        } else if (p[i] == SMF_STATUS_SYSEX || p[i] == SMF_STATUS_SYSEX_ESCAPE) {
+            event.status = p[i++];
+            event.metaType = 0;
+            if (!(vl = memVLQ(p + i, length - i, &event.length))) return 0;
+            i += vl;
+            if (event.length > length - i) return 0;
+            runningStatus = 0;
+
+        } else {
+            /* a channel message, perhaps in running status */
+            if (p[i] & 0x80) runningStatus = p[i++];
+            else if (!runningStatus) return 0;
+            event.status = runningStatus;
+            event.metaType = 0;
+            dataLength = smfDataLength(runningStatus);
+            event.length = dataLength;
+            if ((uint32_t) dataLength > length - i) return 0;
+
+        }
+
+        event.data = p + i;
+        if (patch) patch(&event, arg);
+        i += event.length;
+    }
+
+    return 1;
+}
+
+int smfPatch(const char *filename, SmfPatchFunc patch, void *arg)
+{
+    int fd, ok = 1, track, pass;
+    struct stat sbuf;
+    unsigned char *data;
+    size_t size, start, pos;
+    uint32_t length;
+
+    if ((fd = open(filename, O_RDWR)) < 0 || fstat(fd, &sbuf) < 0) {
+        perror(filename);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    size = sbuf.st_size;
+    if (size < 14) {
+        fprintf(stderr, "%s is not a MIDI file.\n", filename);
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        perror(filename);
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    if (memcmp(data, "MThd", 4)) {
+        fprintf(stderr, "%s is not a MIDI file.\n", filename);
+        munmap(data, size);
+        return 0;
+    }
+
+    start = 8 + (size_t) memN(data + 4, 4);
+    if (start > size) {
+        fprintf(stderr, "%s is not a MIDI file.\n", filename);
+        munmap(data, size);
+        return 0;
+    }
+
+    /* walk the chunks twice: first only checking the tracks, so that a
+     * corrupt file is left untouched, then patching them */
+    for (pass = 0; ok && pass < 2; pass++) {
+        track = 0;
+        pos = start;
+        while (ok && pos + 8 <= size) {
+            length = memN(data + pos + 4, 4);
+            if (length > size - pos - 8) {
+                ok = 0;
+                break;
+            }
+            if (!memcmp(data + pos, "MTrk", 4))
+                ok = patchTrack(data + pos + 8, length, track++, pass ? patch : NULL, arg);
+            pos += 8 + (size_t) length;
+        }
+    }
+    if (!ok)
+        fprintf(stderr, "%s is corrupt, and was left as it was.\n", filename);
+
+    munmap(data, size);
+    return ok;
+}
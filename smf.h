@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SMF_H
+#define SMF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* A minimal reader and writer for standard MIDI files, which works directly on
+ * the file a track and an event at a time, for tools which can't afford to
+ * hold a whole file in memory. Files are read through a single read-only
+ * mapping, shared by all of their tracks' readers. */
+
+#define SMF_STATUS_SYSEX        0xF0
+#define SMF_STATUS_SYSEX_ESCAPE 0xF7
+#define SMF_STATUS_META         0xFF
+#define SMF_META_END_OF_TRACK   0x2F
+
+/* an event in a track. For channel messages, data holds the (one or two) data
+ * bytes; for meta events and sysex, bytes holds length bytes (in the file's
+ * mapping, so read only) */
+struct SmfEvent {
+    uint32_t tick;
+    uint8_t status;
+    uint8_t data[2];
+    uint8_t metaType;
+    uint32_t length;
+    unsigned char *bytes;
+};
+
+/* an open MIDI file, from which tracks can be read */
+struct SmfFile {
+    char *filename;
+    uint16_t format, trackCt, timeDivision;
+
+    /* the whole file, mapped */
+    unsigned char *data;
+    size_t size;
+
+    /* where each track's data starts, and its length */
+    long *trackOffsets;
+    uint32_t *trackLengths;
+};
+
+/* a track being read, straight from the file's mapping */
+struct SmfTrackReader {
+    unsigned char *p; /* next byte in the chunk */
+    uint32_t left; /* bytes left in the chunk */
+    uint32_t tick;
+    uint8_t runningStatus;
+    int done;
+    int endOfTrack; /* did it end with an end-of-track event (at tick)? */
+};
+
+/* a MIDI file being written, a track at a time */
+struct SmfWriter {
+    FILE *f;
+    uint16_t trackCt, tracksWritten;
+    long lengthAt; /* where to write the current track's length */
+    uint32_t tick;
+    uint8_t runningStatus;
+};
+
+/* number of data bytes for a channel message with this status */
+int smfDataLength(uint8_t status);
+
+/* open a MIDI file, reading its header and finding its tracks. Returns NULL
+ * (with a message) if it isn't a valid MIDI file */
+struct SmfFile *smfOpen(const char *filename);
+
+void smfClose(struct SmfFile *file);
+
+/* start reading a track */
+struct SmfTrackReader *smfTrackOpen(struct SmfFile *file, int track);
+
+/* read the next event. Returns 1 for an event, 0 at the end of the track
+ * (whose end-of-track event is not returned), or -1 if the track is corrupt.
+ * Any bytes are valid until the file is closed */
+int smfTrackRead(struct SmfTrackReader *reader, struct SmfEvent *event);
+
+void smfTrackClose(struct SmfTrackReader *reader);
+
+/* start writing a MIDI file with this many tracks */
+struct SmfWriter *smfWriterOpen(const char *filename, uint16_t format,
+    uint16_t trackCt, uint16_t timeDivision);
+
+/* start writing the next track */
+void smfWriterBeginTrack(struct SmfWriter *writer);
+
+/* write an event to the current track. Events must be in order */
+void smfWriterEvent(struct SmfWriter *writer, const struct SmfEvent *event);
+
+/* write a text meta event to the current track */
+void smfWriterText(struct SmfWriter *writer, uint32_t tick, const char *text);
+
+/* finish the current track, adding its end-of-track event */
+void smfWriterEndTrack(struct SmfWriter *writer);
+
+/* finish the current track, with its end-of-track event at tick (or right
+ * after the last event, if that's later) */
+void smfWriterEndTrackAt(struct SmfWriter *writer, uint32_t tick);
+
+/* finish writing. Returns 0 if anything failed to write */
+int smfWriterClose(struct SmfWriter *writer);
+
+/* an event found by smfPatch. data points into the file itself: for channel
+ * messages, at the (one or two) data bytes; for meta events and sysex, at its
+ * length bytes */
+struct SmfRawEvent {
+    int track;
+    uint32_t tick;
+    uint8_t status, metaType;
+    unsigned char *data;
+    uint32_t length;
+};
+
+typedef void (*SmfPatchFunc)(struct SmfRawEvent *event, void *arg);
+
+/* map a MIDI file into memory and call patch for each event in each track
+ * (except end-of-track events), which may change the file by writing to the
+ * event's data, but of course can't change its length. The whole file is
+ * checked before anything is patched, so returns 0 (with a message) and
+ * leaves the file alone if it couldn't be mapped or is corrupt */
+int smfPatch(const char *filename, SmfPatchFunc patch, void *arg);
+
+#endif
@@ -27,11 +27,13 @@
 #include "helpers.h"
 #include "midifile/midi.h"
 #include "midifile/midifstream.h"
+#include "outwriter.h"
 #include "pmhelpers.h"
 
 MfStream *stream = NULL;
 MfStream *ostream = NULL;
 char *ofile = NULL;
+struct OutputWriter outputWriter;
 
 void dump(PtTimestamp timestamp, void *ignore);
 
@@ -62,12 +64,14 @@ int main(int argc, char **argv)
     pfo->timeDivision = 480;
 
     /* now start running */
+    outputWriterStart(&outputWriter, ofile, NULL, NULL);
     stream = Mf_OpenStream(pf);
     ostream = Mf_OpenStream(pfo);
     Mf_StartStream(stream, Pt_Time());
     Mf_StartStream(ostream, Pt_Time());
 
-    while (1) Pt_Sleep(1<<30);
+    /* wait for the output to be written */
+    outputWriterJoin(&outputWriter);
 
     return 0;
 }
@@ -101,14 +105,10 @@ void dump(PtTimestamp timestamp, void *ignore)
     }
 
     if (Mf_StreamEmpty(stream) == TRUE) {
-        MfFile *of;
-        FILE *ofh;
-        Mf_FreeFile(Mf_CloseStream(stream));
-        of = Mf_CloseStream(ostream);
-        SF(ofh, fopen, NULL, (ofile, "wb"));
-        Mf_WriteMidiFile(ofh, of);
-        fclose(ofh);
-        Mf_FreeFile(of);
-        exit(0);
+        /* hand it off to be written, we're done */
+        MfStream *istream = stream;
+        stream = NULL;
+        outputWriterSubmit(&outputWriter, Mf_CloseStream(ostream), Mf_CloseStream(istream));
+        ostream = NULL;
     }
 }
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "args.h"
 #include "helpers.h"
 #include "hplugin.h"
 #include "midifile/midi.h"
@@ -42,6 +43,9 @@ struct TempoTapperState {
     uint8_t metronome;
     int32_t curTick;
     PtTimestamp lastTs;
+
+    /* which input device to listen to, or -1 for all */
+    int source;
 };
 
 int usage(HS);
@@ -51,11 +55,23 @@ int init(HS)
     struct TempoTapperState *pstate;
     SF(pstate, calloc, NULL, (1, sizeof(struct TempoTapperState)));
     pstate->metronome = METRO_PER_QN;
-    pstate->curTick = -1;
+    pstate->curTick = pstate->source = -1;
     hstate->pstate[pnum] = (void *) pstate;
     return 1;
 }
 
+int argHandler(HS, int *argi, char **argv)
+{
+    STATE;
+    char *arg = argv[*argi];
+    ARGN(s, source) {
+        pstate->source = atoi(argv[++*argi]);
+        ++*argi; return 1;
+
+    }
+    return 0;
+}
+
 int begin(HS)
 {
     STATE;
@@ -77,14 +93,15 @@ int begin(HS)
 
 int usage(HS)
 {
-    fprintf(stderr, "tracktapper usage: -p tracktapper -i <input device>\n");
+    fprintf(stderr, "tempotapper usage: -p tempotapper -i <input device> [options]\n"
+                    "tempotapper options:\n"
+                    "\t-s|--source <n>: Only listen to the nth input device (from 0).\n");
     return 1;
 }
 
 void handleBeat(HS, PtTimestamp ts)
 {
     STATE;
-    MfEvent *event;
 
     if (pstate->curTick < 0) {
         /* OK, this is the very first tick. Just initialize */
@@ -106,34 +123,38 @@ void handleBeat(HS, PtTimestamp ts)
         tempo = (diff * 1000) * METRO_PER_QN / pstate->metronome;
         pstate->lastTs = ts;
         if (tempo > 0) {
-            MfMeta *meta;
+            unsigned char data[3];
             Mf_StreamSetTempo(hstate->ifstream, ts, 0, pstate->curTick, tempo);
 
             /* produce the tempo event */
-            event = Mf_NewEvent();
-            event->absoluteTm = lastTick;
-            event->e.message = Pm_Message(MIDI_STATUS_META, 0, 0);
-            event->meta = meta = Mf_NewMeta(3);
-            meta->type = MIDI_M_TEMPO;
-            meta->data[0] = (tempo >> 16) & 0xFF;
-            meta->data[1] = (tempo >> 8) & 0xFF;
-            meta->data[2] = tempo & 0xFF;
-            Mf_StreamWriteOne(hstate->ofstream, 0, event);
+            data[0] = (tempo >> 16) & 0xFF;
+            data[1] = (tempo >> 8) & 0xFF;
+            data[2] = tempo & 0xFF;
+            hstate->writeMeta(hstate, 0, lastTick, MIDI_M_TEMPO, 3, data);
         }
     }
 }
 
 int tickPreMidi(HS, PtTimestamp timestamp)
 {
-    PmEvent ev;
+    STATE;
+    int32_t i;
+
+    for (i = 0; i < hstate->inputCt; i++) {
+        PmEvent ev = hstate->input[i];
+        int32_t nextTick = hstate->nextTick;
+        if (pstate->source >= 0 && hstate->inputSource[i] != pstate->source) continue;
 
-    while (Pm_Read(hstate->idstream, &ev, 1) == 1) {
         /* take a nonzero controller event or a note on as a tick */
         uint8_t type = Pm_MessageType(ev.message);
         uint8_t dat2 = Pm_MessageData2(ev.message);
         if ((type == MIDI_NOTE_ON || type == MIDI_CONTROLLER) && dat2 > 0) {
             handleBeat(hstate, pnum, timestamp);
         }
+
+        /* if that moved us on, it's what released the next notes */
+        if (hstate->nextTick != nextTick && hstate->released < 0)
+            hstate->released = i;
     }
 
     return 1;
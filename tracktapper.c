@@ -28,6 +28,8 @@
 #include "helpers.h"
 #include "midifile/midi.h"
 #include "midifile/midifstream.h"
+#include "noteindex.h"
+#include "outwriter.h"
 #include "pmhelpers.h"
 
 #define METRO_PER_QN 24
@@ -42,6 +44,9 @@ PortMidiStream *odstream = NULL;
 
 int ready = 0;
 
+/* writes our output file once we're done */
+struct OutputWriter outputWriter;
+
 /* tempo file to write to */
 char *tfile = NULL;
 
@@ -60,6 +65,9 @@ double velocityMix = 0.5;
 char master = -1;
 int track = 0;
 
+/* the notes of each track, for finding the next one */
+struct NoteIndex *noteIndex = NULL;
+
 /* controller info */
 struct Controller {
     uint8_t seen, ranged, baseval, lastval;
@@ -78,7 +86,7 @@ int main(int argc, char **argv)
     PmError perr;
     PtError pterr;
     MfFile *pf, *tf;
-    int argi, i;
+    int argi, i, trackCt;
     char *arg, *nextarg, *ifile;
 
     PmDeviceID idev = -1, odev = -1;
@@ -168,6 +176,12 @@ int main(int argc, char **argv)
     PSF(perr, Mf_ReadMidiFile, (&pf, f));
     fclose(f);
     timeDivision = pf->timeDivision;
+    if (track < 0 || track >= pf->trackCt) {
+        fprintf(stderr, "No such track: %d\n", track);
+        exit(1);
+    }
+    noteIndex = noteIndexBuild(pf);
+    trackCt = pf->trackCt;
 
     /* now start running */
     ifstream = Mf_OpenStream(pf);
@@ -176,9 +190,13 @@ int main(int argc, char **argv)
     tf = Mf_NewFile(pf->timeDivision);
     tstream = Mf_OpenStream(tf);
 
+    outputWriterStart(&outputWriter, tfile, NULL, NULL);
     ready = 1;
 
-    while (1) Pt_Sleep(1<<30);
+    /* wait for the output to be written (which frees pf) */
+    outputWriterJoin(&outputWriter);
+    noteIndexFree(noteIndex, trackCt);
+    Pm_Terminate();
 
     return 0;
 }
@@ -194,14 +212,11 @@ void usage()
 
 int findNextTick(uint32_t atleast)
 {
-    MfTrack *mtrack = ifstream->file->tracks[track];
-    MfEvent *cur;
-    for (cur = mtrack->head; cur; cur = cur->next) {
-        if (cur->absoluteTm >= atleast && Pm_MessageType(cur->e.message) == MIDI_NOTE_ON) {
-            nextTick = cur->absoluteTm;
-            nextVelocity = Pm_MessageData2(cur->e.message);
-            return 1;
-        }
+    struct NoteIndexEntry *note = noteIndexNext(noteIndex + track, atleast);
+    if (note) {
+        nextTick = note->absoluteTm;
+        nextVelocity = note->velocity;
+        return 1;
     }
 
     /* didn't find one, set it huge */
@@ -357,15 +372,8 @@ void handler(PtTimestamp timestamp, void *ignore)
     }
 
     if (Mf_StreamEmpty(ifstream) == TRUE) {
-        MfFile *of;
-        FILE *ofh;
-        Mf_FreeFile(Mf_CloseStream(ifstream));
-        of = Mf_CloseStream(tstream);
-        SF(ofh, fopen, NULL, (tfile, "wb"));
-        Mf_WriteMidiFile(ofh, of);
-        fclose(ofh);
-        Mf_FreeFile(of);
-        Pm_Terminate();
-        exit(0);
+        /* hand it off to be written, we're done */
+        ready = 0;
+        outputWriterSubmit(&outputWriter, Mf_CloseStream(tstream), Mf_CloseStream(ifstream));
     }
 }
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the AVX2 path is compiled for its own function, and chosen at run time, so
+ * the default build needn't require AVX2 */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define VEL_AVX2 1
+#endif
+
+#include "helpers.h"
+#include "midifile/midi.h"
+#include "velcurve.h"
+
+void velCurveIdentity(VelCurve curve)
+{
+    int v;
+    for (v = 0; v < 128; v++) curve[v] = v;
+}
+
+void velCurveCompress(VelCurve curve, int redux)
+{
+    int v;
+    curve[0] = 0;
+    for (v = 1; v < 128; v++) curve[v] = 127 - (127-v)/redux;
+}
+
+void velCurveGamma(VelCurve curve, double gamma)
+{
+    int v, out;
+
+    /* 0 is a note-off, so leave it be */
+    curve[0] = 0;
+    for (v = 1; v < 128; v++) {
+        out = (int) (127.0 * pow(v / 127.0, gamma) + 0.5);
+        if (out < 1) out = 1;
+        if (out > 127) out = 127;
+        curve[v] = out;
+    }
+}
+
+int velCurvePoints(VelCurve curve, const char *points)
+{
+    int ins[128], outs[128];
+    int ct = 0, v, i, n;
+    const char *cur = points;
+
+    /* read the points */
+    while (*cur) {
+        if (ct >= 128 ||
+            sscanf(cur, "%d/%d%n", &ins[ct], &outs[ct], &n) < 2 ||
+            ins[ct] < 0 || ins[ct] > 127 || outs[ct] < 0 || outs[ct] > 127 ||
+            (ct > 0 && ins[ct] <= ins[ct-1]))
+            return 0;
+        ct++;
+        cur += n;
+        if (*cur == ',') cur++;
+        else if (*cur) return 0;
+    }
+    if (ct == 0) return 0;
+
+    /* then draw lines between them, flat beyond the ends */
+    for (v = 0, i = 0; v < 128; v++) {
+        while (i < ct && ins[i] < v) i++;
+        if (i == 0) curve[v] = outs[0];
+        else if (i == ct) curve[v] = outs[ct-1];
+        else curve[v] = outs[i-1] +
+            (outs[i] - outs[i-1]) * (v - ins[i-1]) / (ins[i] - ins[i-1]);
+
+        /* a note mustn't become a note-off */
+        if (curve[v] < 1) curve[v] = 1;
+    }
+    curve[0] = 0;
+
+    return 1;
+}
+
+static void tableSet(struct VelTable *table, int channel, VelCurve curve)
+{
+    int ch, v;
+    for (ch = 0; ch < 16; ch++) {
+        if (channel != -1 && channel != ch) continue;
+        /* whatever the curve says, a note-off stays a note-off, and a note
+         * stays a note */
+        table->data2[ch * 128] = 0;
+        for (v = 1; v < 128; v++)
+            table->data2[ch * 128 + v] = (uint32_t) (curve[v] ? curve[v] : 1) << 16;
+    }
+}
+
+struct VelMap *velMapNew(void)
+{
+    struct VelMap *map;
+    VelCurve identity;
+
+    SF(map, calloc, NULL, (1, sizeof(struct VelMap)));
+    velCurveIdentity(identity);
+    tableSet(&map->all, -1, identity);
+
+    return map;
+}
+
+void velMapFree(struct VelMap *map)
+{
+    int ti;
+    for (ti = 0; ti < map->trackCt; ti++)
+        free(map->tracks[ti]);
+    free(map->tracks);
+    free(map);
+}
+
+void velMapSet(struct VelMap *map, int track, int channel, VelCurve curve)
+{
+    int ti;
+
+    if (track < 0) {
+        /* every track, including those with their own tables */
+        tableSet(&map->all, channel, curve);
+        for (ti = 0; ti < map->trackCt; ti++)
+            if (map->tracks[ti]) tableSet(map->tracks[ti], channel, curve);
+        return;
+    }
+
+    /* give this track its own table, starting from what it had */
+    if (track >= map->trackCt) {
+        SF(map->tracks, realloc, NULL, (map->tracks, (track + 1) * sizeof(struct VelTable *)));
+        while (map->trackCt <= track)
+            map->tracks[map->trackCt++] = NULL;
+    }
+    if (!map->tracks[track]) {
+        SF(map->tracks[track], malloc, NULL, (sizeof(struct VelTable)));
+        memcpy(map->tracks[track], &map->all, sizeof(struct VelTable));
+    }
+    tableSet(map->tracks[track], channel, curve);
+}
+
+int velMapParse(struct VelMap *map, const char *spec)
+{
+    VelCurve curve;
+    int track = -1, channel = -1, redux;
+    const char *eq, *colon;
+    double gamma;
+
+    /* perhaps it's for only some tracks or channels */
+    if ((eq = strchr(spec, '='))) {
+        colon = strchr(spec, ':');
+        if (!colon || colon > eq) goto error;
+        if (spec[0] != '*') track = atoi(spec);
+        if (colon[1] != '*') channel = atoi(colon + 1) - 1;
+        if (track < -1 || channel < -1 || channel > 15) goto error;
+        spec = eq + 1;
+    }
+
+    if (!strncmp(spec, "gamma:", 6)) {
+        gamma = atof(spec + 6);
+        if (gamma <= 0) goto error;
+        velCurveGamma(curve, gamma);
+
+    } else if (!strncmp(spec, "points:", 7)) {
+        if (!velCurvePoints(curve, spec + 7)) goto error;
+
+    } else {
+        if (!strncmp(spec, "compress:", 9)) spec += 9;
+        redux = atoi(spec);
+        if (redux <= 0) goto error;
+        velCurveCompress(curve, redux);
+
+    }
+
+    velMapSet(map, track, channel, curve);
+    return 1;
+
+error:
+    fprintf(stderr, "Invalid velocity curve %s\n", spec);
+    return 0;
+}
+
+void velMapUsage(FILE *to)
+{
+    fprintf(to, "Curves:\n"
+                "  <n> or compress:<n>          reduce the range to the top 1/n\n"
+                "  gamma:<g>                    127*(v/127)^g\n"
+                "  points:<in>/<out>,...        straight lines between points\n"
+                "Prefix a curve with <track>:<channel>= (channels 1-16, either may be *) to\n"
+                "use it for only some events. Later curves override earlier ones.\n");
+}
+
+const struct VelTable *velMapTable(struct VelMap *map, int track)
+{
+    if (track >= 0 && track < map->trackCt && map->tracks[track])
+        return map->tracks[track];
+    return &map->all;
+}
+
+/* apply a table to one message */
+#define VEL_APPLY_ONE(table, message) do { \
+    if (((message) & 0xF0) == (MIDI_NOTE_ON << 4)) \
+        (message) = ((message) & ~0xFF0000) | \
+            (table)->data2[(((message) & 0xF) << 7) | (((message) >> 16) & 0x7F)]; \
+} while (0)
+
+#ifdef VEL_AVX2
+/* eight at a time, looking the velocities up with a gather. Returns how many
+ * it did */
+__attribute__((target("avx2")))
+static uint32_t velApplyAVX2(const struct VelTable *table, PmMessage *messages, uint32_t count)
+{
+    const __m256i statusMask = _mm256_set1_epi32(0xF0);
+    const __m256i noteOn = _mm256_set1_epi32(MIDI_NOTE_ON << 4);
+    const __m256i channelMask = _mm256_set1_epi32(0xF);
+    const __m256i velMask = _mm256_set1_epi32(0x7F);
+    const __m256i data2Mask = _mm256_set1_epi32(0xFF0000);
+    uint32_t i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m256i m, on, idx, vel;
+
+        m = _mm256_loadu_si256((const __m256i *) (messages + i));
+        on = _mm256_cmpeq_epi32(_mm256_and_si256(m, statusMask), noteOn);
+        if (_mm256_testz_si256(on, on)) continue;
+
+        idx = _mm256_or_si256(
+            _mm256_slli_epi32(_mm256_and_si256(m, channelMask), 7),
+            _mm256_and_si256(_mm256_srli_epi32(m, 16), velMask));
+        vel = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+            (const int *) table->data2, idx, on, 4);
+        m = _mm256_blendv_epi8(m,
+            _mm256_or_si256(_mm256_andnot_si256(data2Mask, m), vel), on);
+        _mm256_storeu_si256((__m256i *) (messages + i), m);
+    }
+
+    return i;
+}
+#endif
+
+#ifdef __SSE2__
+/* four at a time, skipping any four without a note-on (usually most of them,
+ * since every note-on has a note-off). SSE2 has no gather, so the lookups
+ * themselves are scalar. Returns how many it did */
+static uint32_t velApplySSE2(const struct VelTable *table, PmMessage *messages, uint32_t count)
+{
+    const __m128i statusMask = _mm_set1_epi32(0xF0);
+    const __m128i noteOn = _mm_set1_epi32(MIDI_NOTE_ON << 4);
+    uint32_t i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m128i m, on;
+        int bits, j;
+
+        m = _mm_loadu_si128((const __m128i *) (messages + i));
+        on = _mm_cmpeq_epi32(_mm_and_si128(m, statusMask), noteOn);
+        bits = _mm_movemask_ps(_mm_castsi128_ps(on));
+        if (!bits) continue;
+
+        for (j = 0; j < 4; j++)
+            if (bits & (1 << j))
+                VEL_APPLY_ONE(table, messages[i+j]);
+    }
+
+    return i;
+}
+#endif
+
+void velApply(const struct VelTable *table, PmMessage *messages, uint32_t count)
+{
+    uint32_t i = 0;
+
+#ifdef VEL_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        i = velApplyAVX2(table, messages, count);
+#endif
+#ifdef __SSE2__
+    if (i == 0)
+        i = velApplySSE2(table, messages, count);
+#endif
+
+    for (; i < count; i++)
+        VEL_APPLY_ONE(table, messages[i]);
+}
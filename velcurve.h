@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012  Gregor Richards
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef VELCURVE_H
+#define VELCURVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "midifile/midifile.h"
+
+/* a velocity curve: the new velocity for each velocity. A note-on with
+ * velocity 0 is a note-off, so every curve keeps 0 as 0, and nothing else
+ * as 0 */
+typedef uint8_t VelCurve[128];
+
+void velCurveIdentity(VelCurve curve);
+
+/* compress to the top 1/redux of the range (hreducevel's original curve) */
+void velCurveCompress(VelCurve curve, int redux);
+
+/* velocity = 127 * (velocity/127)^gamma, so < 1 is louder and > 1 is quieter */
+void velCurveGamma(VelCurve curve, double gamma);
+
+/* straight lines between points, given as "<in>/<out>,<in>/<out>,...".
+ * Returns 0 if they're invalid */
+int velCurvePoints(VelCurve curve, const char *points);
+
+/* a curve for every channel, already shifted into place as a PmMessage's
+ * data2, so that applying it is just a lookup and an OR */
+struct VelTable {
+    uint32_t data2[16 * 128];
+};
+
+/* the tables for each track */
+struct VelMap {
+    struct VelTable all; /* for tracks without their own */
+    struct VelTable **tracks;
+    int trackCt;
+};
+
+struct VelMap *velMapNew(void);
+void velMapFree(struct VelMap *map);
+
+/* use a curve for a track and channel (0-15), either of which may be -1 for
+ * all. Later curves override earlier ones */
+void velMapSet(struct VelMap *map, int track, int channel, VelCurve curve);
+
+/* parse and set a curve, like "4", "gamma:0.8" or "2:10=points:0/0,127/100".
+ * Returns 0 (with a message) if it's invalid */
+int velMapParse(struct VelMap *map, const char *spec);
+
+/* describe the curve syntax */
+void velMapUsage(FILE *to);
+
+/* the table for a track */
+const struct VelTable *velMapTable(struct VelMap *map, int track);
+
+/* apply a table to the note-ons among count messages, leaving everything else
+ * alone. Uses an AVX2 gather on CPUs which have it (checked at run time), and
+ * otherwise SSE2 only to skip runs without note-ons */
+void velApply(const struct VelTable *table, PmMessage *messages, uint32_t count);
+
+#endif